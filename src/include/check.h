@@ -0,0 +1,73 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stddef.h>
+
+#define HEAP_REPORT_FAULTS         16                  // Faults recorded with their address in a report
+#define HEAP_CHECK_MAX_WORKERS     16                  // Upper bound of threads verifying the heap
+#define HEAP_CHECK_WORKER_SLOTS    16384               // Slots that justify one more worker
+#define HEAP_CHECK_STACK_SIZE      (64 * 1024)         // Stack of each worker thread
+
+/**
+ * The kind of inconsistency found by fl_check_heap()
+ *
+ * - HEAP_OK:                 No inconsistency
+ * - HEAP_SLOT_MODE:          The slot has a mode that is not known to the allocator
+ * - HEAP_SLOT_SIZE:          The internal and user address/size of the slot do not agree
+ * - HEAP_SLOT_OVERLAP:       The memory of the slot overlaps with the memory of the next slot
+ * - HEAP_SLOT_NOT_COALESCED: Two adjacent free slots were not merged into one
+ * - HEAP_BIN_CANARY:         The canary bytes of a bin chunk are corrupted
+ * - HEAP_BIN_LINK:           A bin list, the list of empty slabs or the free list of a slab leads outside the slabs or chunks it holds
+ * - HEAP_GUARD_CANARY:       The canary bytes before a trailing page allocation are corrupted
+ * - HEAP_BIN_SLAB:           The header of a bin slab does not agree with its chunks
+ */
+typedef enum _heap_error
+{
+    HEAP_OK = 0,
+    HEAP_SLOT_MODE,
+    HEAP_SLOT_SIZE,
+    HEAP_SLOT_OVERLAP,
+    HEAP_SLOT_NOT_COALESCED,
+    HEAP_BIN_CANARY,
+    HEAP_BIN_LINK,
+    HEAP_GUARD_CANARY,
+    HEAP_BIN_SLAB,
+    NUMBER_OF_HEAP_ERRORS,
+} heap_error;
+
+/**
+ * A single inconsistency and the address it was found at
+ */
+typedef struct _heap_fault
+{
+    heap_error error;          /**< The kind of inconsistency */
+    void* address;             /**< The slot or chunk address */
+} heap_fault;
+
+/**
+ * The result of a heap integrity check
+ */
+typedef struct _heap_report
+{
+    size_t slots;                          /**< The number of slots verified */
+    size_t bin_chunks;                     /**< The number of bin chunks verified */
+    size_t heap_size;                      /**< The bytes of memory covered by the slots */
+    int workers;                           /**< The number of threads that shared the check */
+    size_t errors;                         /**< The total number of inconsistencies */
+    size_t count[NUMBER_OF_HEAP_ERRORS];   /**< The number of inconsistencies of each kind */
+    size_t faults;                         /**< The number of entries used in fault */
+    heap_fault fault[HEAP_REPORT_FAULTS];  /**< The first inconsistencies found */
+} heap_report;
+
+/**
+ * Verify the invariants of every slot and every bin chunk
+ *
+ * The slots are split into address ranges of the same count across worker threads
+ * when there are many. The heap is held while the check runs, other threads wait
+ * for it.
+ * @param report The report to fill, may be NULL
+ * @return The number of inconsistencies found, 0 for a consistent heap
+ */
+size_t fl_check_heap(heap_report* report);
+
+#endif // CHECK_H
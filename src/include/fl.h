@@ -2,15 +2,90 @@
 #define FL_H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <page.h>
 
 #define get_address(base, offset) (void*)((char*)base + offset)
 #define get_bin_index(internal_size) (uint8_t)(internal_size / CHUNK_ALIGNMENT - 3)
 #define get_bin_size(index) (size_t)((size_t)(index + 3) * CHUNK_ALIGNMENT)
+#define get_bin_chunks(index, page_size) (size_t)((page_size - get_bin_first(index, page_size)) / get_bin_size(index))
+
+/*
+ * The chunks of a bin start where their user addresses are aligned to the largest power
+ * of two dividing the bin size, so every chunk of the bin has that alignment. Bins whose
+ * aligned first chunk would not fit the page start right after the header.
+ */
+#define get_bin_align(index)         (size_t)(CHUNK_ALIGNMENT * (((index) + 3) & -((index) + 3)))
+#define get_bin_aligned_first(index) (size_t)(((BIN_SLAB_HEADER + 2 * CHUNK_ALIGNMENT + get_bin_align(index) - 1) & \
+                                               ~(get_bin_align(index) - 1)) - 2 * CHUNK_ALIGNMENT)
+#define get_bin_first(index, page_size)                                                              \
+    (size_t)(get_bin_aligned_first(index) + get_bin_size(index) <= (page_size) ? get_bin_aligned_first(index) \
+                                                                               : BIN_SLAB_HEADER)
 
 #define get_bin_alloc_status(metadata)   (bool)((uintptr_t)metadata & 1)
 #define get_bin_alloc_next(metadata)     (uintptr_t)((uintptr_t)metadata & ~1UL)
 
+#define BIN_MAX_COUNT      254  // Bin indexes fit the canary byte, below POOL_CANARY
+#define SLOT_INDEX_ENTRIES 3    // Entries of the address index per slot, it is at most two thirds full
+#define SLOT_REACH_RETRIES 16   // Places near heap_base tried for memory the system put out of the reach of the slots
+#define PREWARM_BATCH      64   // Bin pages carved from the pool in one pass at start
+#define BIN_SLAB_HEADER    48   // The bin_slab at the start of a bin page, chunks follow it
+#define BIN_EMPTY_SLABS    8    // Empty slabs kept for any bin to reuse, older ones go back to the pool
+#define BIN_EMPTY_DELAY    4096 // Bin frees an empty slab is kept for before it goes back to the pool
+
+#define GUARD_ENV          "FL_GUARD"  // "trailing" puts page allocations against a trailing guard page
+#define GUARD_CANARY       0xFF        // Fills the 16 bytes before a trailing page allocation, above any bin index
+#define POOL_CANARY        0xFE        // The canary bytes of pool objects, above any bin index
+
+/*
+ * The tiers of the library, one engine built by src/CMakeLists.txt as libfl-full
+ * (neither flag), libfl-lite (FL_NO_PROTECT) and libfl-fast (both flags). What a
+ * tier leaves out is removed by the compiler, nothing is decided at run time.
+ *
+ * - FL_NO_PROTECT: mprotect() is never called, page allocations own no guard page
+ *                  and the metadata and the freed pages stay accessible
+ * - FL_NO_CHECKS:  frees trust their argument, canary bytes, double frees and
+ *                  invalid frees are not looked for; stats, traces, profiles and
+ *                  samples are not taken, see instrumented()
+ */
+#ifdef FL_NO_PROTECT
+#define GUARD_PAGES        0
+#else
+#define GUARD_PAGES        1
+#endif
+
+/* A heap error test, constant false in builds without checks so the branch is compiled out */
+#ifdef FL_NO_CHECKS
+#define checked(condition) (false && (condition))
+#else
+#define checked(condition) (condition)
+#endif
+
+/* A test for an instrumentation of the heap, constant false in builds without checks like checked() */
+#ifdef FL_NO_CHECKS
+#define instrumented(condition) (false && (condition))
+#else
+#define instrumented(condition) (condition)
+#endif
+
+/**
+ * Where page allocations are placed in their pages
+ *
+ * - GUARD_LEADING:  The buffer starts right after a guard page, underruns fault at once
+ * - GUARD_TRAILING: The buffer ends right before a guard page, overruns fault at once
+ *
+ * Either way every page allocation owns one guard page, which covers one direction.
+ * The other faults only when the pages next to the buffer are free or the guard of
+ * another page allocation, not when they hold bin slabs or metadata. Builds with
+ * FL_NO_PROTECT have no guard pages and always lead.
+ */
+typedef enum _guard_mode
+{
+    GUARD_LEADING = 0,
+    GUARD_TRAILING,
+} guard_mode;
+
 /**
  * The mode corresponding to each slot, indicates the status of the memory buffer
  * 
@@ -31,26 +106,212 @@ typedef enum _mode
 
 /**
  * The slot structure contains the metadata of the buffer except the contents
+ *
+ * A slot is packed into the parallel arrays of the registry: slot_list holds where
+ * the memory and the buffer are, slot_pages the size of the memory in pages and
+ * slot_modes the mode, so scanning for a mode or a size reads 5 bytes per slot.
+ * The memory starts page pages after heap_base. The buffer starts user_offset bytes
+ * into it and ends user_slack bytes before its end, a slot whose owner takes the
+ * whole memory has both at 0. Slots are read with the get_slot_*() accessors.
  */
 typedef struct _slot
 {
-    void* internal_address;    /**< The actual virtual address  */
-    void* user_address;        /**< The user address */
-    size_t internal_size;      /**< The size of the memory with metadata and original data */
-    size_t user_size;          /**< The size of original data */
-    mode mode;                 /**< The mode of the slot */
+    uint32_t page;             /**< The first page of the memory, counted from heap_base */
+    uint32_t user_offset;      /**< The bytes from the start of the memory to the buffer */
+    uint32_t user_slack;       /**< The bytes from the end of the buffer to the end of the memory */
 } slot;
 
+/* The registry bytes of a slot: the packed slot, its size, its mode and its share of the address index */
+#define SLOT_BYTES (sizeof(slot) + sizeof(uint32_t) + sizeof(uint8_t) + SLOT_INDEX_ENTRIES * sizeof(uint32_t))
+
+#define get_slot_number(s)           (size_t)((s) - slot_list)
+#define get_slot_mode(s)             (mode)slot_modes[get_slot_number(s)]
+#define get_slot_internal_address(s) (void*)(heap_base + (uintptr_t)(s)->page * PAGE_SIZE)
+#define get_slot_internal_size(s)    (size_t)((size_t)slot_pages[get_slot_number(s)] * PAGE_SIZE)
+#define get_slot_user_address(s)     get_address(get_slot_internal_address(s), (s)->user_offset)
+#define get_slot_user_size(s)        (size_t)(get_slot_internal_size(s) - (s)->user_offset - (s)->user_slack)
+
+/**
+ * The list a bin slab is linked in
+ *
+ * - SLAB_UNLISTED: Every chunk of the slab is allocated
+ * - SLAB_PARTIAL:  The slab has free chunks and is in the list of its bin
+ * - SLAB_EMPTY:    No chunk of the slab is allocated, it waits in the empty list to be reused or released
+ */
+typedef enum _slab_list
+{
+    SLAB_UNLISTED = 0,
+    SLAB_PARTIAL,
+    SLAB_EMPTY,
+} slab_list;
+
+/**
+ * The header of a bin page, the chunks of a single bin follow it
+ *
+ * Each slab keeps its own free chunks, linked through the metadata word of the
+ * chunks, so a slab whose last chunk is freed is found and unlinked in O(1).
+ */
+typedef struct _bin_slab
+{
+    struct _bin_slab* prev;    /**< The previous slab of the list */
+    struct _bin_slab* next;    /**< The next slab of the list */
+    uintptr_t free;            /**< The first free chunk, 0 when the slab is full */
+    uint64_t empty_since;      /**< The count of bin frees when the slab became empty */
+    uint32_t live;             /**< The number of allocated chunks */
+    uint16_t chunks;           /**< The number of chunks */
+    uint8_t ind;               /**< The index of the bin */
+    uint8_t list;              /**< The slab_list it is linked in */
+    uint64_t reserved;
+} bin_slab;
+
+/* States of slot list and bin allocator, owned by fl.c */
+extern slot* slot_list;
+extern uint32_t* slot_pages;
+extern uint8_t* slot_modes;
+extern uintptr_t heap_base;
+extern size_t slot_list_size;
+extern int slot_count;
+extern int number_of_bins;
+extern size_t threshold;
+extern guard_mode guard;
+extern bin_slab* empty_slabs;
+extern bin_slab* empty_slabs_tail;
+extern size_t empty_slab_count;
+
+#ifdef FL_NO_PROTECT
+#define allow_access_internal() ((void)0)
+#define deny_access_internal()  ((void)0)
+#else
+/**
+ * Allow read/write access to the slot list and the bin allocator
+ */
+void allow_access_internal();
+
+/**
+ * Revoke access to the slot list and the bin allocator
+ */
+void deny_access_internal();
+#endif
+
+/**
+ * Take pages for the metadata of the library, they never carry a guard page
+ * @param size The size, rounded up to whole pages
+ * @return The pages, marked INTERNAL_USE_SLOT so that free() refuses them
+ */
+void* fl_internal_alloc(size_t size);
+
+/**
+ * Give back pages taken with fl_internal_alloc()
+ * @param addr The pages
+ */
+void fl_internal_free(void* addr);
+
+/**
+ * Give back a list of page runs taken with fl_internal_alloc() at once
+ *
+ * The heap is locked and the metadata opened once for the whole list.
+ * @param first The first run, each run starts with a pointer to the next one, NULL ends the list
+ */
+void fl_internal_free_list(void* first);
+
+/**
+ * The allocation behind malloc() and the other entry points of the library
+ * @param alignment The alignment of the buffer
+ * @param size The size of buffer to be allocated
+ * @param caller The return address of the entry point, where the stack of a sample starts
+ * @return The buffer, NULL if the alignment cannot be served
+ */
+void* fl_allocate(size_t alignment, size_t size, void* caller);
+
 /**
  * fault-line version of malloc()
  * @param size The size of buffer to be allocated
  */
 void* malloc(size_t size);
 
+/**
+ * fault-line version of calloc()
+ * @param count The number of elements
+ * @param size The size of an element
+ */
+void* calloc(size_t count, size_t size);
+
+/**
+ * fault-line version of realloc(), the buffer always moves
+ * @param user_address The buffer to resize, may be NULL
+ * @param size The new size of the buffer
+ */
+void* realloc(void* user_address, size_t size);
+
+/**
+ * fault-line version of posix_memalign()
+ * @param user_address Where the buffer is stored
+ * @param alignment A power of two multiple of sizeof(void*)
+ * @param size The size of buffer to be allocated
+ * @return 0, EINVAL for an invalid alignment or ENOMEM if the buffer cannot be served
+ */
+int posix_memalign(void** user_address, size_t alignment, size_t size);
+
+/**
+ * fault-line version of aligned_alloc()
+ * @param alignment A power of two
+ * @param size The size of buffer to be allocated
+ * @return The buffer, NULL for an invalid alignment or if the buffer cannot be served
+ */
+void* aligned_alloc(size_t alignment, size_t size);
+
 /**
  * fault-line version of free()
+ *
+ * While another thread holds the heap, the buffer is queued and released and
+ * checked by the next thread that allocates or frees.
  * @param arr The user address of buffer memory to be freed
  */
 void free(void* user_address);
 
+/**
+ * Allocate n buffers of the same size in one call
+ *
+ * The metadata is opened once and the buffers are carved in one pass from the
+ * bin chain or from a single free span, which beats n calls to malloc().
+ * @param size The size of each buffer
+ * @param n The number of buffers
+ * @param out The n buffers
+ * @return The number of buffers allocated, n or 0
+ */
+size_t fl_malloc_batch(size_t size, size_t n, void** out);
+
+/**
+ * Free n buffers in one call, the metadata is opened once for the whole batch
+ * @param user_addresses The buffers, NULL entries are skipped
+ * @param n The number of buffers
+ */
+void fl_free_batch(void** user_addresses, size_t n);
+
+/**
+ * C23 free_sized(), free() of a buffer from malloc(), calloc() or realloc() of known size
+ * @param user_address The user address of buffer memory to be freed
+ * @param size The size given when the buffer was allocated
+ */
+void free_sized(void* user_address, size_t size);
+
+/**
+ * C23 free_aligned_sized(), free() of a buffer from aligned_alloc() of known size
+ * @param user_address The user address of buffer memory to be freed
+ * @param alignment The alignment given when the buffer was allocated
+ * @param size The size given when the buffer was allocated
+ */
+void free_aligned_sized(void* user_address, size_t alignment, size_t size);
+
+/**
+ * free() for callers that know the size of the buffer, like C++ sized delete
+ *
+ * The size leads straight to the bin or the slot of the buffer, and a size
+ * other than the one given to malloc() is reported as a size mismatch.
+ * @param user_address The user address of buffer memory to be freed
+ * @param size The size given when the buffer was allocated
+ * @param alignment The alignment given when the buffer was allocated
+ */
+void fl_free_sized(void* user_address, size_t size, size_t alignment);
+
 #endif // FL_H
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef LOCK_H
+#define LOCK_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define REMOTE_FREE_ENTRIES  4096  // Frees queued while the heap is busy, a power of 2
+#define REMOTE_FREE_BATCH    64    // Queued frees released per pass of the drain
+
+/**
+ * Take the heap lock, waiting for the thread holding it
+ *
+ * The lock is recursive: the allocator calls malloc() and free() for its own
+ * metadata while it holds it.
+ */
+void heap_lock();
+
+/**
+ * Take the heap lock if it is free or already held by the calling thread
+ * @return true if the lock was taken
+ */
+bool heap_trylock();
+
+/**
+ * Release one level of the heap lock
+ */
+void heap_unlock();
+
+/**
+ * The levels of the heap lock held by the calling thread
+ * @return 0 if the calling thread does not hold the lock
+ */
+int heap_lock_depth();
+
+/**
+ * Reset the heap lock and drop the queued frees, in the child of fork() only
+ *
+ * The only thread of the child is the one that forked, which held the lock
+ * around fork(). The frees queued by the threads left behind are leaked.
+ */
+void heap_lock_reset();
+
+/**
+ * Queue a free for the holder of the heap lock, with a single compare and swap
+ *
+ * Nothing is checked and the buffer is not touched, its checks run when the
+ * queue is drained.
+ * @param addr The address passed to free()
+ * @return false if the queue is full
+ */
+bool remote_free_push(void* addr);
+
+/**
+ * Tell whether frees are queued
+ */
+bool remote_free_pending();
+
+/**
+ * Take queued frees, only the holder of the heap lock may call this
+ *
+ * The frees are taken in order up to the first entry claimed but not yet published,
+ * which is left with the ones after it to the next call.
+ * @param out The addresses taken
+ * @param n The capacity of out
+ * @return The number of addresses taken
+ */
+size_t remote_free_take(void** out, size_t n);
+
+#endif // LOCK_H
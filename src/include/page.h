@@ -3,12 +3,33 @@
 
 #include <unistd.h>
 
-#define PAGE_SIZE            (size_t)sysconf(_SC_PAGESIZE)
+/*
+ * Builds for a known page size (cmake -DFL_PAGE_SIZE=4096) see a constant, which
+ * turns the divisions and modulos by the page size into shifts and masks. Other
+ * builds ask the system once and read the cached value afterwards.
+ */
+#ifdef FL_PAGE_SIZE
+#if FL_PAGE_SIZE < 4096 || (FL_PAGE_SIZE & (FL_PAGE_SIZE - 1))
+#error "FL_PAGE_SIZE must be a power of two of at least 4096"
+#endif
+#define PAGE_SIZE            ((size_t)FL_PAGE_SIZE)
+#else
+#define PAGE_SIZE            (system_page_size ? system_page_size : page_size_query())
+#endif
 
 #define CHUNK_ALIGNMENT      16           // Assume that every chunk in malloc is 16 byte aligned
 #define MEMORY_CREATION_SIZE 1024 * 1024  // Create this much memory in a single request
 #define CANARY_BYTE          0xFA
 
+/* The page size of the system, 0 until page_size_query() ran */
+extern size_t system_page_size;
+
+/**
+ * Ask the system for its page size and cache it in system_page_size
+ * @return The page size
+ */
+size_t page_size_query();
+
 /**
  * Create a memory block of a given size
  * @param size The size of memory block
@@ -16,6 +37,29 @@
  */
 void* page_create(size_t size);
 
+/**
+ * Create a memory block, at the given address if it is free
+ *
+ * The system places the block elsewhere when the address is taken, the caller
+ * compares the result with the hint.
+ * @param hint The address wanted for the block
+ * @param size The size of memory block
+ * @return The address of the newly created memory block
+ */
+void* page_create_at(void* hint, size_t size);
+
+/**
+ * Return a memory block created by page_create() to the operating system
+ * @param address The address of memory block
+ * @param size The size of memory block
+ */
+void page_destroy(void* address, size_t size);
+
+#ifdef FL_NO_PROTECT
+/* Builds without protection never call mprotect(), every page stays readable and writable */
+#define page_allow_access(address, size) ((void)(address), (void)(size))
+#define page_deny_access(address, size)  ((void)(address), (void)(size))
+#else
 /**
  * Allow read/write access to memory locations from [address, address+size-1]
  * @param address The address
@@ -29,5 +73,6 @@ void page_allow_access(void* address, size_t size);
  * @param size The size
  */
 void page_deny_access(void* address, size_t size);
+#endif
 
 #endif // PAGE_H
\ No newline at end of file
@@ -0,0 +1,52 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+#define POOL_SLAB_PAGES  16                  // Pages taken from the heap each time a pool runs dry
+#define POOL_MAGIC       0x6c6f6f706c66UL    // "flpool" in little endian, marks a live pool
+
+/* A pool of objects of one size, see pool.c */
+typedef struct _fl_pool fl_pool;
+
+/**
+ * Create a pool of fixed size objects
+ *
+ * Objects are laid out like bin chunks, behind a metadata word and canary bytes,
+ * and are carved from slabs the pool owns. Only the slabs are taken from the heap
+ * under its lock, the pool itself is not locked: the threads sharing one must
+ * serialize their calls.
+ * @param object_size The size of every object
+ * @param alignment A power of two, at most the page size, 0 for the alignment of malloc()
+ * @return The pool, NULL if the alignment cannot be served
+ */
+fl_pool* fl_pool_create(size_t object_size, size_t alignment);
+
+/**
+ * Take an object from the pool
+ *
+ * The last freed object is handed out first, otherwise the next one is cut from
+ * the newest slab.
+ * @param pool The pool
+ * @return The object, NULL if the heap is out of memory
+ */
+void* fl_pool_alloc(fl_pool* pool);
+
+/**
+ * Give an object back to its pool
+ *
+ * Double frees, corrupted canary bytes and objects of another pool are heap errors.
+ * @param pool The pool the object was taken from
+ * @param addr The object, NULL is ignored
+ */
+void fl_pool_free(fl_pool* pool, void* addr);
+
+/**
+ * Release the pool and every object still taken from it at once
+ *
+ * The canary bytes of every object are checked one last time.
+ * @param pool The pool
+ */
+void fl_pool_destroy(fl_pool* pool);
+
+#endif // POOL_H
@@ -1,6 +1,8 @@
 #ifndef PRINT_H
 #define PRINT_H
 
+#include <stdarg.h>
+
 /*
  * These routines do their printing without using stdio. stdio can't
  * be used because it calls malloc(). Internal routines of a malloc()
@@ -9,6 +11,7 @@
 
 void print(char* format_string, ...);
 void print_error(char* format_string, ...);
+void vprint_error(char* format_string, va_list args);
 void fl_error(char* format_string, ...);
 
 #endif // PRINT_H
@@ -0,0 +1,57 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <stats.h>
+
+#define PROFILE_MAGIC    0x6c69666f72706c66UL  // "flprofil" in little endian
+#define PROFILE_VERSION  1
+#define PROFILE_ENV      "FL_PROFILE"          // path of the profile, read at start and written at exit
+
+/**
+ * The heap profile of a run, the peaks a later run prepares its heap for
+ */
+typedef struct _profile_data
+{
+    uint64_t magic;                            /**< PROFILE_MAGIC */
+    uint32_t version;                          /**< PROFILE_VERSION of the layout */
+    uint32_t reserved;
+    uint64_t page_size;                        /**< The page size the peaks were counted with */
+    int64_t peak_pages;                        /**< The most pool pages held at once */
+    int64_t peak_slots;                        /**< The most slots in use at once */
+    int64_t peak_chunks[STATS_CLASSES];        /**< The most live chunks of each bin at once */
+} profile_data;
+
+/* The profile being recorded, NULL when FL_PROFILE is not set */
+extern profile_data* profile;
+
+/* The profile of the previous run, NULL when there is none to warm up from */
+extern const profile_data* profile_previous;
+
+/**
+ * Load the profile of the previous run and start recording if FL_PROFILE is set
+ */
+void profile_init();
+
+/**
+ * Count chunks taken from or returned to a bin
+ * @param ind The index of the bin
+ * @param delta The change of live chunks
+ */
+void profile_chunks(int ind, int64_t delta);
+
+/**
+ * Count pool pages handed out or given back
+ * @param delta The change of held pages
+ */
+void profile_pages(int64_t delta);
+
+/**
+ * Note the number of slots in use
+ * @param used The slots currently in use
+ */
+void profile_slots(int64_t used);
+
+#endif // PROFILE_H
@@ -0,0 +1,48 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define REGION_SPAN_PAGES  16                    // Pages of a span, its trailing guard page included
+#define REGION_MAGIC       0x6e6f6967656c66UL    // "flegion" in little endian, marks a live region
+#define REGION_CANARY      0xFD                  // The canary bytes around the objects of a checked region
+
+/* A region of objects released together, see region.c */
+typedef struct _fl_region fl_region;
+
+/**
+ * Create a region
+ *
+ * Objects are cut one after the other from spans of pages, each span ends with a
+ * guard page. A region is not locked: the threads sharing one must serialize
+ * their calls.
+ * @param span_size The size of each span, 0 for REGION_SPAN_PAGES pages
+ * @param canaries true to put canary bytes around every object, checked by fl_region_destroy()
+ * @return The region
+ */
+fl_region* fl_region_create(size_t span_size, bool canaries);
+
+/**
+ * Cut an object from the region, it lives until the region is destroyed
+ *
+ * An object too large for a span gets a span of its own and ends against its guard
+ * page. Other objects follow each other from the start of the span, only an overrun
+ * past the end of the span meets the guard page, the canary bytes of a checked
+ * region catch the others when it is destroyed.
+ * @param region The region
+ * @param size The size of the object
+ * @return The object aligned to CHUNK_ALIGNMENT, NULL if the heap is out of memory
+ */
+void* fl_region_alloc(fl_region* region, size_t size);
+
+/**
+ * Release every object of the region at once
+ *
+ * The spans are released in one pass, with the heap locked and the metadata opened once.
+ * In a region created with canaries, the canary bytes of every object are checked first.
+ * @param region The region
+ */
+void fl_region_destroy(fl_region* region);
+
+#endif // REGION_H
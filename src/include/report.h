@@ -0,0 +1,76 @@
+#ifndef REPORT_H
+#define REPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define REPORT_ENV              "FL_ON_ERROR"  // "continue" reports heap errors instead of exiting
+#define REPORT_SEEN_ENTRIES     1024           // Errors remembered to report each kind and address once
+#define REPORT_SEEN_PROBES      16             // Entries looked at before an error counts as unseen
+#define REPORT_PER_SECOND       10             // Reports printed per second, the rest is only counted
+
+/**
+ * The kind of heap error found by malloc() and free()
+ *
+ * - FAULT_DOUBLE_FREE:   The buffer was already freed
+ * - FAULT_INVALID_FREE:  The address was never handed out by malloc()
+ * - FAULT_CANARY:        The canary bytes in front of the buffer are corrupted
+ * - FAULT_SIZE_MISMATCH: A sized free was given another size than malloc()
+ */
+typedef enum _fault_kind
+{
+    FAULT_DOUBLE_FREE = 0,
+    FAULT_INVALID_FREE,
+    FAULT_CANARY,
+    FAULT_SIZE_MISMATCH,
+    NUMBER_OF_FAULT_KINDS,
+} fault_kind;
+
+/**
+ * What happens to the process on a heap error
+ *
+ * - REPORT_ABORT:    Print the error and exit, the default
+ * - REPORT_CONTINUE: Print the error, leave the buffer alone and return to the caller
+ */
+typedef enum _report_mode
+{
+    REPORT_ABORT = 0,
+    REPORT_CONTINUE,
+} report_mode;
+
+/**
+ * The heap errors of the process so far
+ */
+typedef struct _fault_counters
+{
+    uint64_t count[NUMBER_OF_FAULT_KINDS];  /**< Errors of each kind, repeated ones included */
+    uint64_t reported;                      /**< Errors printed */
+    uint64_t duplicates;                    /**< Errors not printed because their kind and address were */
+    uint64_t suppressed;                    /**< Errors not printed because of the rate limit */
+} fault_counters;
+
+extern report_mode report;
+
+/**
+ * Choose the report mode from FL_ON_ERROR
+ */
+void report_init();
+
+/**
+ * Count a heap error and print it unless it is a duplicate or over the rate limit
+ *
+ * In REPORT_ABORT mode the process exits. Otherwise the caller must leave the
+ * buffer alone: it is leaked rather than handed out again.
+ * @param kind The kind of error
+ * @param address The address the error was found at
+ * @param format_string The message, in the formats of print()
+ */
+void fl_fault(fault_kind kind, void* address, char* format_string, ...);
+
+/**
+ * Read the heap error counters
+ * @param counters The counters
+ */
+void fl_fault_counters(fault_counters* counters);
+
+#endif // REPORT_H
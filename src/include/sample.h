@@ -0,0 +1,81 @@
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SAMPLE_RATE_ENV       "FL_SAMPLE_RATE"   // mean bytes between two samples, sampling is off unless set
+#define SAMPLE_DEFAULT_RATE   (512 * 1024)       // The rate when only FL_HEAP_PROFILE is set
+#define SAMPLE_DUMP_ENV       "FL_HEAP_PROFILE"  // path prefix of the profiles SIGUSR2 dumps
+#define SAMPLE_MAX_FRAMES     32                 // Frames kept of the stack of a sample
+#define SAMPLE_ENTRIES        16384              // Live samples tracked at most, a power of 2
+
+/**
+ * The stack of an allocation picked for sampling
+ */
+typedef struct _sample_stack
+{
+    void* frames[SAMPLE_MAX_FRAMES];  /**< Return addresses, the caller of malloc() first */
+    int depth;                        /**< The number of frames */
+} sample_stack;
+
+/* The mean number of bytes between two samples, 0 when sampling is off */
+extern size_t sample_rate;
+
+/* The number of sampled buffers that are still allocated */
+extern size_t sample_live;
+
+/* Set by SIGUSR2, the next allocation dumps the profile */
+extern volatile int sample_dump_requested;
+
+/**
+ * Read the sampling rate and install the SIGUSR2 handler if FL_HEAP_PROFILE is set
+ *
+ * Sampling is off unless one of the two is set, and always in builds without checks.
+ */
+void sample_init();
+
+/**
+ * Count the bytes of an allocation against the sampling interval of the calling thread
+ *
+ * Samples are taken at exponentially distributed byte intervals, so the chance of
+ * a buffer to be sampled grows with its size. The stack is captured here, before
+ * the heap is locked: unwinding may load libraries, which takes the loader lock.
+ * @param size The requested size
+ * @param caller The return address of the entry point, the frames above it are the library's
+ * @param stack The stack of the allocation if it is sampled
+ * @return true if the allocation is sampled
+ */
+bool sample_take(size_t size, void* caller, sample_stack* stack);
+
+/**
+ * Add a sampled buffer to the profile, with the heap locked
+ * @param addr The buffer
+ * @param size The requested size
+ * @param stack The stack captured by sample_take()
+ */
+void sample_record(void* addr, size_t size, const sample_stack* stack);
+
+/**
+ * Remove a buffer from the profile if it was sampled, with the heap locked
+ * @param addr The buffer being freed
+ */
+void sample_forget(void* addr);
+
+/**
+ * Dump the profile to the next file of the FL_HEAP_PROFILE prefix, as asked by SIGUSR2
+ */
+void sample_dump_signaled();
+
+/**
+ * Write the live samples in the heap profile format of pprof
+ *
+ * The file is the heap_v2 text format of gperftools, one line per live sample
+ * followed by the mappings of the process: "pprof <binary> <file>" reads it.
+ * @param path The file to write
+ * @return 0 on success, -1 if the file cannot be written
+ */
+int fl_heap_profile_dump(const char* path);
+
+#endif // SAMPLE_H
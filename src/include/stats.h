@@ -0,0 +1,112 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <fl.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define STATS_MAGIC             0x73746174736c66UL  // "flstats" in little endian
+#define STATS_VERSION           1
+#define STATS_PATH_PREFIX       "/dev/shm/fl-stats."  // followed by the pid of the process
+#define STATS_PATH_LENGTH       64
+#define STATS_ENV               "FL_STATS"            // set to a non-empty value to publish stats
+
+#define STATS_CLASSES           256                   // bin classes followed by the page class
+#define STATS_PAGE_CLASS        (STATS_CLASSES - 1)   // live bytes of page allocations
+#define STATS_HISTOGRAM_BUCKETS 64                    // bucket i counts latencies in [2^i, 2^(i+1))
+
+/**
+ * The allocator paths whose operations are counted
+ *
+ * - STATS_MALLOC_BIN:   malloc() served by the bin allocator
+ * - STATS_MALLOC_PAGES: malloc() served by guarded pages
+ * - STATS_FREE_BIN:     free() of a bin chunk
+ * - STATS_FREE_PAGES:   free() of guarded pages
+ */
+typedef enum _stats_path
+{
+    STATS_MALLOC_BIN = 0,
+    STATS_MALLOC_PAGES,
+    STATS_FREE_BIN,
+    STATS_FREE_PAGES,
+    NUMBER_OF_STATS_PATHS,
+} stats_path;
+
+/**
+ * The layout of the stats segment shared with readers like fl-top
+ *
+ * Counters only ever grow (except live bytes) and are updated with relaxed atomics,
+ * so a reader sees a slightly stale but never torn value.
+ */
+typedef struct _stats_segment
+{
+    uint64_t magic;                                        /**< STATS_MAGIC once the segment is ready */
+    uint32_t version;                                      /**< STATS_VERSION of the layout */
+    int32_t pid;                                           /**< The process publishing the stats */
+    uint64_t page_size;                                    /**< The page size of the process */
+    uint64_t ops[NUMBER_OF_STATS_PATHS];                   /**< Operations per allocator path */
+    int64_t live_bytes[STATS_CLASSES];                     /**< Bytes in use per size class */
+    uint64_t mmap_calls;                                   /**< Memory blocks created with mmap */
+    uint64_t munmap_calls;                                 /**< Memory blocks released with munmap */
+    uint64_t mprotect_calls;                               /**< Access changes with mprotect */
+    uint64_t malloc_latency[STATS_HISTOGRAM_BUCKETS];      /**< log2 histogram of malloc() ticks */
+    uint64_t free_latency[STATS_HISTOGRAM_BUCKETS];        /**< log2 histogram of free() ticks */
+} stats_segment;
+
+/* The published segment, NULL when stats are disabled */
+extern stats_segment* stats;
+
+/**
+ * Create the stats segment of this process if FL_STATS is set
+ */
+void stats_init();
+
+static inline void
+stats_add(uint64_t* counter, uint64_t value)
+{
+    __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+/**
+ * A cheap timestamp, in cpu ticks where available
+ */
+static inline uint64_t
+stats_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+#endif
+}
+
+static inline void
+stats_latency(uint64_t* histogram, uint64_t start)
+{
+    uint64_t ticks = stats_clock() - start;
+    stats_add(&histogram[63 - __builtin_clzl(ticks | 1)], 1);
+}
+
+static inline void
+stats_malloc(int class, size_t bytes)
+{
+    if (!instrumented(stats)) return;
+    stats_add(&stats->ops[class == STATS_PAGE_CLASS ? STATS_MALLOC_PAGES : STATS_MALLOC_BIN], 1);
+    stats_add((uint64_t*)&stats->live_bytes[class], bytes);
+}
+
+static inline void
+stats_free(int class, size_t bytes)
+{
+    if (!instrumented(stats)) return;
+    stats_add(&stats->ops[class == STATS_PAGE_CLASS ? STATS_FREE_PAGES : STATS_FREE_BIN], 1);
+    stats_add((uint64_t*)&stats->live_bytes[class], -bytes);
+}
+
+#endif // STATS_H
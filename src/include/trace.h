@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRACE_MAGIC            0x65636172746c66UL  // "fltrace" in little endian
+#define TRACE_VERSION          1
+#define TRACE_ENV              "FL_TRACE"          // path of the trace file, tracing is off without it
+#define TRACE_RECORDS_ENV      "FL_TRACE_RECORDS"  // capacity of the trace file in records
+#define TRACE_DEFAULT_RECORDS  (32 * 1024 * 1024)  // 1 GB of records, the file is sparse
+#define TRACE_RING_RECORDS     1024                // records buffered per thread before a flush
+
+/**
+ * The operation of a trace record
+ *
+ * - TRACE_MALLOC: malloc() returned address for size bytes
+ * - TRACE_FREE:   free() was called on address
+ */
+typedef enum _trace_op
+{
+    TRACE_MALLOC = 1,
+    TRACE_FREE,
+} trace_op;
+
+/**
+ * A single allocator operation
+ */
+typedef struct _trace_record
+{
+    uint64_t timestamp;        /**< Ticks of stats_clock() when the operation happened */
+    uint64_t address;          /**< The address identifying the allocation */
+    uint64_t size;             /**< The requested size, 0 for free() */
+    uint32_t thread;           /**< The kernel id of the calling thread */
+    uint32_t op;               /**< The trace_op */
+} trace_record;
+
+/**
+ * The header at the start of a trace file, records follow it
+ *
+ * Records are flushed in blocks per thread, so the file is only ordered inside a
+ * block. Readers sort by timestamp.
+ */
+typedef struct _trace_header
+{
+    uint64_t magic;            /**< TRACE_MAGIC */
+    uint32_t version;          /**< TRACE_VERSION of the layout */
+    uint32_t record_size;      /**< sizeof(trace_record) */
+    uint64_t capacity;         /**< The number of records the file can hold */
+    uint64_t written;          /**< The number of records claimed by flushes */
+    uint64_t dropped;          /**< The number of records lost because the file was full */
+    uint64_t reserved[3];
+} trace_header;
+
+/* The header of the mapped trace file, NULL when tracing is disabled */
+extern trace_header* trace;
+
+/**
+ * Map the trace file if FL_TRACE is set
+ */
+void trace_init();
+
+/**
+ * Append an operation to the ring of the calling thread, flushing it when full
+ * @param op The trace_op
+ * @param address The address returned by malloc() or passed to free()
+ * @param size The requested size
+ */
+void trace_append(trace_op op, void* address, size_t size);
+
+#endif // TRACE_H
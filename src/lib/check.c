@@ -0,0 +1,642 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <fl.h>
+#include <page.h>
+#include <check.h>
+#include <lock.h>
+
+/**
+ * A slot unpacked from the registry, the workers never read its packed arrays
+ */
+typedef struct _heap_slot
+{
+    void* internal_address;    /**< The start of the memory */
+    void* user_address;        /**< The start of the buffer */
+    size_t internal_size;      /**< The size of the memory */
+    size_t user_size;          /**< The size of the buffer */
+    mode mode;                 /**< The mode of the slot */
+} heap_slot;
+
+/**
+ * The start and the end of a check, shared by its workers
+ */
+typedef struct _check_gate
+{
+    uint32_t open;             /**< Set once the snapshot is taken, the workers wait for it */
+    uint32_t running;          /**< The started workers that have not finished their share */
+} check_gate;
+
+/**
+ * The share of the heap verified by one thread
+ *
+ * Workers only read the snapshot and the bin pages while the caller holds the heap
+ * for them. They are started before the snapshot is taken: pthread_create() may call
+ * malloc() for the thread, which must not change the heap under the snapshot.
+ */
+typedef struct _check_worker
+{
+    heap_slot* slots;          /**< The snapshot of used slots sorted by internal address */
+    size_t slot_count;         /**< The number of slots in the snapshot */
+    size_t first;              /**< The first slot verified by this worker */
+    size_t last;               /**< One past the last slot verified by this worker */
+    uintptr_t* bins;           /**< The snapshot of the heads of the bin lists */
+    bin_slab* empty;           /**< The snapshot of the head of the empty slabs */
+    bin_slab* empty_tail;      /**< The snapshot of the tail of the empty slabs */
+    size_t empty_count;        /**< The snapshot of the number of empty slabs */
+    size_t max_slabs;          /**< Upper bound of slabs in a bin list, to catch cycles */
+    size_t page_size;          /**< The page size of the system */
+    int id;                    /**< The index of this worker */
+    int workers;               /**< The total number of workers */
+    heap_report report;        /**< The inconsistencies found by this worker */
+    check_gate* gate;          /**< The gate of the check */
+    pthread_t thread;          /**< The thread of the worker */
+    bool started;              /**< Whether the thread runs, the caller does the share otherwise */
+} check_worker;
+
+static size_t round_up(size_t size, size_t alignment);
+static void record_fault(heap_report* report, heap_error error, void* address);
+static void sort_slots(heap_slot* slots, size_t count);
+static heap_slot* find_slot(check_worker* w, uintptr_t address);
+static size_t count_used_slots();
+
+static void check_slot(check_worker* w, size_t index);
+static void check_trailing_slot(check_worker* w, heap_slot* s);
+static void check_bin_page(check_worker* w, heap_slot* s);
+static void check_bin_list(check_worker* w, int ind);
+static void check_empty_list(check_worker* w);
+static void* check_worker_thread(void* arg);
+static void check_worker_run(check_worker* w);
+static void merge_report(heap_report* report, heap_report* part);
+
+size_t
+fl_check_heap(heap_report* report)
+{
+    size_t page_size = PAGE_SIZE;
+    heap_report local;
+    check_worker workers[HEAP_CHECK_MAX_WORKERS];
+    check_gate gate = { 0, 0 };
+    pthread_attr_t attr;
+    slot* s = NULL;
+    heap_slot* slots = NULL;
+    uintptr_t* bins = NULL;
+    void* scratch = NULL;
+    size_t scratch_size = 0;
+    size_t used = 0;
+    size_t max_slabs = 0;
+    uint32_t running;
+    int count = 0;
+    int nworkers = 1;
+    long cpus = 0;
+
+    if (report == NULL)
+    {
+        report = &local;
+    }
+    memset(report, 0, sizeof(heap_report));
+
+    /* nothing was allocated yet */
+    if (slot_list == NULL)
+    {
+        return 0;
+    }
+
+    /* the heap is held until the last worker is done with the bin pages */
+    heap_lock();
+
+    allow_access_internal();
+    used = count_used_slots();
+    deny_access_internal();
+
+    /* One worker per HEAP_CHECK_WORKER_SLOTS slots, bounded by the online cpus */
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    nworkers = used / HEAP_CHECK_WORKER_SLOTS + 1;
+    if (nworkers > cpus)
+    {
+        nworkers = cpus;
+    }
+    if (nworkers > HEAP_CHECK_MAX_WORKERS)
+    {
+        nworkers = HEAP_CHECK_MAX_WORKERS;
+    }
+    if (nworkers < 1)
+    {
+        nworkers = 1;
+    }
+
+    memset(workers, 0, nworkers * sizeof(check_worker));
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, HEAP_CHECK_STACK_SIZE);
+    for (count = 1; count < nworkers; count++)
+    {
+        check_worker* w = &workers[count];
+
+        /* a worker that could not get a thread has its share done here */
+        w->gate = &gate;
+        if (pthread_create(&w->thread, &attr, check_worker_thread, w) == 0)
+        {
+            w->started = true;
+            gate.running++;
+        }
+    }
+    pthread_attr_destroy(&attr);
+
+    allow_access_internal();
+
+    /* Take a snapshot of slots and bin heads, workers never touch the protected metadata */
+    used = count_used_slots();
+    scratch_size = round_up(used * sizeof(heap_slot) + number_of_bins * sizeof(uintptr_t), page_size);
+    scratch = page_create(scratch_size);
+    slots = (heap_slot*)scratch;
+    bins = (uintptr_t*)get_address(slots, used * sizeof(heap_slot));
+
+    used = 0;
+    for (s = slot_list, count = 0; count < slot_count; count++, s++)
+    {
+        if (get_slot_mode(s) == IOTA_SLOT)
+        {
+            continue;
+        }
+        slots[used].internal_address = get_slot_internal_address(s);
+        slots[used].user_address = get_slot_user_address(s);
+        slots[used].internal_size = get_slot_internal_size(s);
+        slots[used].user_size = get_slot_user_size(s);
+        slots[used].mode = get_slot_mode(s);
+        if (slots[used++].mode == ALLOCATED_BIN_SLOT)
+        {
+            max_slabs++;
+        }
+    }
+    for (count = 0; count < number_of_bins; count++)
+    {
+        bins[count] = *((uintptr_t*)get_address(get_slot_internal_address(&slot_list[1]), count * CHUNK_ALIGNMENT));
+    }
+    workers[0].empty = empty_slabs;
+    workers[0].empty_tail = empty_slabs_tail;
+    workers[0].empty_count = empty_slab_count;
+
+    deny_access_internal();
+
+    sort_slots(slots, used);
+
+    /* Split the sorted slots into address ranges of the same number of slots */
+    for (count = 0; count < nworkers; count++)
+    {
+        check_worker* w = &workers[count];
+
+        w->slots = slots;
+        w->slot_count = used;
+        w->bins = bins;
+        w->max_slabs = max_slabs;
+        w->page_size = page_size;
+        w->id = count;
+        w->workers = nworkers;
+        w->first = used * count / nworkers;
+        w->last = used * (count + 1) / nworkers;
+    }
+
+    __atomic_store_n(&gate.open, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &gate.open, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+
+    for (count = 0; count < nworkers; count++)
+    {
+        if (!workers[count].started)
+        {
+            check_worker_run(&workers[count]);
+        }
+    }
+
+    while ((running = __atomic_load_n(&gate.running, __ATOMIC_ACQUIRE)) != 0)
+    {
+        syscall(SYS_futex, &gate.running, FUTEX_WAIT_PRIVATE, running, NULL, NULL, 0);
+    }
+
+    heap_unlock();
+
+    for (count = 1; count < nworkers; count++)
+    {
+        if (workers[count].started)
+        {
+            pthread_join(workers[count].thread, NULL);
+        }
+    }
+
+    for (count = 0; count < nworkers; count++)
+    {
+        merge_report(report, &workers[count].report);
+    }
+    report->workers = nworkers;
+
+    page_destroy(scratch, scratch_size);
+
+    return report->errors;
+}
+
+static size_t
+count_used_slots()
+{
+    size_t used = 0;
+
+    for (int i = 0; i < slot_count; i++)
+    {
+        if (slot_modes[i] != IOTA_SLOT)
+        {
+            used++;
+        }
+    }
+    return used;
+}
+
+static void*
+check_worker_thread(void* arg)
+{
+    check_worker* w = (check_worker*)arg;
+    check_gate* gate = w->gate;
+
+    while (__atomic_load_n(&gate->open, __ATOMIC_ACQUIRE) == 0)
+    {
+        syscall(SYS_futex, &gate->open, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+    }
+
+    check_worker_run(w);
+
+    if (__atomic_sub_fetch(&gate->running, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        syscall(SYS_futex, &gate->running, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+    return NULL;
+}
+
+static void
+check_worker_run(check_worker* w)
+{
+    size_t index;
+    int ind;
+
+    for (index = w->first; index < w->last; index++)
+    {
+        check_slot(w, index);
+    }
+
+    /* bin lists are spread over the workers by their index, the empty slabs go to the first */
+    for (ind = w->id; ind < number_of_bins; ind += w->workers)
+    {
+        check_bin_list(w, ind);
+    }
+    if (w->id == 0)
+    {
+        check_empty_list(w);
+    }
+}
+
+static void
+check_slot(check_worker* w, size_t index)
+{
+    size_t page_size = w->page_size;
+    heap_slot* s = &w->slots[index];
+    heap_slot* nxt = (index + 1 < w->slot_count) ? &w->slots[index + 1] : NULL;
+    uintptr_t end = (uintptr_t)get_address(s->internal_address, s->internal_size);
+
+    w->report.slots++;
+    w->report.heap_size += s->internal_size;
+
+    /* every slot spans whole pages */
+    if ((uintptr_t)s->internal_address % page_size || s->internal_size % page_size || !s->internal_size)
+    {
+        record_fault(&w->report, HEAP_SLOT_SIZE, s->internal_address);
+    }
+
+    switch (s->mode)
+    {
+        case FREE_SLOT:
+        case INTERNAL_USE_SLOT:
+        case ALLOCATED_BIN_SLOT:
+            /* the whole chunk belongs to its owner */
+            if (s->user_address != s->internal_address || s->user_size != s->internal_size)
+            {
+                record_fault(&w->report, HEAP_SLOT_SIZE, s->internal_address);
+            }
+            if (s->mode == ALLOCATED_BIN_SLOT)
+            {
+                check_bin_page(w, s);
+            }
+            break;
+        case ALLOCATED_SLOT:
+            /* one guard page and just enough pages for the user */
+            if (s->internal_size != round_up(round_up(s->user_size, CHUNK_ALIGNMENT) + GUARD_PAGES * page_size, page_size))
+            {
+                record_fault(&w->report, HEAP_SLOT_SIZE, s->internal_address);
+            }
+            else if (s->user_address != get_address(s->internal_address, GUARD_PAGES * page_size))
+            {
+                check_trailing_slot(w, s);
+            }
+            break;
+        default:
+            record_fault(&w->report, HEAP_SLOT_MODE, s->internal_address);
+            break;
+    }
+
+    if (nxt == NULL)
+    {
+        return;
+    }
+
+    if (end > (uintptr_t)nxt->internal_address)
+    {
+        record_fault(&w->report, HEAP_SLOT_OVERLAP, nxt->internal_address);
+    }
+    else if (end == (uintptr_t)nxt->internal_address && s->mode == FREE_SLOT && nxt->mode == FREE_SLOT)
+    {
+        record_fault(&w->report, HEAP_SLOT_NOT_COALESCED, nxt->internal_address);
+    }
+}
+
+static void
+check_trailing_slot(check_worker* w, heap_slot* s)
+{
+    size_t page_size = w->page_size;
+    uintptr_t user = (uintptr_t)s->user_address;
+    uintptr_t guard = (uintptr_t)get_address(s->internal_address, s->internal_size - page_size);
+
+    /* the buffer sits in the first page and ends less than a page before the trailing guard */
+    if (user < (uintptr_t)s->internal_address || user % CHUNK_ALIGNMENT || user + s->user_size > guard ||
+        guard - user - s->user_size >= page_size)
+    {
+        record_fault(&w->report, HEAP_SLOT_SIZE, s->internal_address);
+        return;
+    }
+
+    /* free() tells the buffer apart from a bin chunk by these bytes */
+    for (size_t j = 0; user % page_size && j < CHUNK_ALIGNMENT; j++)
+    {
+        if (((uint8_t*)s->user_address)[(ptrdiff_t)j - CHUNK_ALIGNMENT] != GUARD_CANARY)
+        {
+            record_fault(&w->report, HEAP_GUARD_CANARY, s->user_address);
+            break;
+        }
+    }
+}
+
+static void
+check_bin_page(check_worker* w, heap_slot* s)
+{
+    size_t page_size = w->page_size;
+    bin_slab* slab = (bin_slab*)s->internal_address;
+    uint8_t ind = slab->ind;
+    uintptr_t first = (uintptr_t)get_address(slab, get_bin_first(ind, page_size));
+    uintptr_t free_chunk;
+    size_t bin_size;
+    size_t chunks;
+    size_t live = 0;
+    size_t free_chunks = 0;
+
+    if (ind >= number_of_bins || slab->chunks != get_bin_chunks(ind, page_size))
+    {
+        record_fault(&w->report, HEAP_BIN_SLAB, slab);
+        return;
+    }
+
+    bin_size = get_bin_size(ind);
+    chunks = slab->chunks;
+    for (size_t i = 0; i < chunks; i++)
+    {
+        void* cur = get_address(first, i * bin_size);
+        uintptr_t metadata = *((uintptr_t*)cur);
+        uintptr_t next = get_bin_alloc_next(metadata);
+        uint8_t* canary = (uint8_t*)get_address(cur, CHUNK_ALIGNMENT);
+
+        w->report.bin_chunks++;
+
+        for (size_t j = 0; j < CHUNK_ALIGNMENT; j++)
+        {
+            if (canary[j] != ind)
+            {
+                record_fault(&w->report, HEAP_BIN_CANARY, get_address(cur, 2 * CHUNK_ALIGNMENT));
+                break;
+            }
+        }
+
+        /* an allocated chunk links nowhere, a free one to another chunk of the slab */
+        if (get_bin_alloc_status(metadata))
+        {
+            live++;
+            if (next)
+            {
+                record_fault(&w->report, HEAP_BIN_LINK, cur);
+            }
+        }
+        else if (next && (next < first || (next - first) % bin_size || (next - first) / bin_size >= chunks))
+        {
+            record_fault(&w->report, HEAP_BIN_LINK, cur);
+        }
+    }
+
+    /* the free list of the slab holds exactly the chunks that are not allocated */
+    for (free_chunk = slab->free; free_chunk && free_chunks <= chunks; free_chunk = get_bin_alloc_next(*((uintptr_t*)free_chunk)))
+    {
+        if (free_chunk < first || (free_chunk - first) % bin_size || (free_chunk - first) / bin_size >= chunks ||
+            get_bin_alloc_status(*((uintptr_t*)free_chunk)))
+        {
+            record_fault(&w->report, HEAP_BIN_LINK, (void*)free_chunk);
+            return;
+        }
+        free_chunks++;
+    }
+
+    if (slab->live != live || live + free_chunks != chunks || (slab->list == SLAB_PARTIAL && live == chunks) ||
+        (slab->list == SLAB_EMPTY && live) || (slab->list == SLAB_UNLISTED && live != chunks) || slab->list > SLAB_EMPTY)
+    {
+        record_fault(&w->report, HEAP_BIN_SLAB, slab);
+    }
+}
+
+static void
+check_bin_list(check_worker* w, int ind)
+{
+    bin_slab* slab = (bin_slab*)w->bins[ind];
+    bin_slab* prev = NULL;
+    size_t length = 0;
+
+    while (slab)
+    {
+        heap_slot* s = find_slot(w, (uintptr_t)slab);
+
+        /* the list of a bin links the headers of its slabs that have free chunks */
+        if (s == NULL || s->mode != ALLOCATED_BIN_SLOT || s->internal_address != slab ||
+            slab->ind != ind || slab->list != SLAB_PARTIAL || slab->prev != prev)
+        {
+            record_fault(&w->report, HEAP_BIN_LINK, slab);
+            return;
+        }
+
+        /* a list longer than all bin slabs together must be a cycle */
+        if (++length > w->max_slabs)
+        {
+            record_fault(&w->report, HEAP_BIN_LINK, slab);
+            return;
+        }
+
+        prev = slab;
+        slab = slab->next;
+    }
+}
+
+static void
+check_empty_list(check_worker* w)
+{
+    bin_slab* slab = w->empty;
+    bin_slab* prev = NULL;
+    size_t length = 0;
+
+    while (slab)
+    {
+        heap_slot* s = find_slot(w, (uintptr_t)slab);
+
+        /* the empty slabs of every bin are linked by their headers */
+        if (s == NULL || s->mode != ALLOCATED_BIN_SLOT || s->internal_address != slab || slab->prev != prev ||
+            ++length > w->max_slabs)
+        {
+            record_fault(&w->report, HEAP_BIN_LINK, slab);
+            return;
+        }
+
+        /* and are in that list alone, without a chunk handed out */
+        if (slab->list != SLAB_EMPTY || slab->live != 0)
+        {
+            record_fault(&w->report, HEAP_BIN_SLAB, slab);
+        }
+
+        prev = slab;
+        slab = slab->next;
+    }
+
+    /* the trim takes the oldest empty slab from the tail */
+    if (prev != w->empty_tail || length != w->empty_count)
+    {
+        record_fault(&w->report, HEAP_BIN_LINK, w->empty_tail);
+    }
+}
+
+static heap_slot*
+find_slot(check_worker* w, uintptr_t address)
+{
+    size_t low = 0;
+    size_t high = w->slot_count;
+
+    /* binary search for the slot whose memory contains the address */
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        heap_slot* s = &w->slots[mid];
+
+        if (address < (uintptr_t)s->internal_address)
+        {
+            high = mid;
+        }
+        else if (address >= (uintptr_t)get_address(s->internal_address, s->internal_size))
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            return s;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+sort_slots(heap_slot* slots, size_t count)
+{
+    heap_slot tmp;
+    size_t start = count / 2;
+    size_t end = count;
+
+    /* heap sort by internal address, qsort() may call malloc() */
+    while (end > 1)
+    {
+        size_t root;
+
+        if (start > 0)
+        {
+            start--;
+        }
+        else
+        {
+            end--;
+            tmp = slots[0];
+            slots[0] = slots[end];
+            slots[end] = tmp;
+        }
+
+        root = start;
+        while (2 * root + 1 < end)
+        {
+            size_t child = 2 * root + 1;
+
+            if (child + 1 < end && slots[child].internal_address < slots[child + 1].internal_address)
+            {
+                child++;
+            }
+            if (slots[root].internal_address >= slots[child].internal_address)
+            {
+                break;
+            }
+            tmp = slots[root];
+            slots[root] = slots[child];
+            slots[child] = tmp;
+            root = child;
+        }
+    }
+}
+
+static void
+record_fault(heap_report* report, heap_error error, void* address)
+{
+    report->errors++;
+    report->count[error]++;
+    if (report->faults < HEAP_REPORT_FAULTS)
+    {
+        report->fault[report->faults].error = error;
+        report->fault[report->faults].address = address;
+        report->faults++;
+    }
+}
+
+static void
+merge_report(heap_report* report, heap_report* part)
+{
+    report->slots += part->slots;
+    report->bin_chunks += part->bin_chunks;
+    report->heap_size += part->heap_size;
+    report->errors += part->errors;
+    for (int i = 0; i < NUMBER_OF_HEAP_ERRORS; i++)
+    {
+        report->count[i] += part->count[i];
+    }
+    for (size_t i = 0; i < part->faults && report->faults < HEAP_REPORT_FAULTS; i++)
+    {
+        report->fault[report->faults++] = part->fault[i];
+    }
+}
+
+static size_t
+round_up(size_t size, size_t alignment)
+{
+    size_t slack;
+
+    if ((slack = size % alignment) != 0)
+    {
+        size += alignment - slack;
+    }
+    return size;
+}
@@ -2,22 +2,51 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
 
 #include <fl.h>
 #include <page.h>
 #include <print.h>
-
-/* States of slot list */
+#include <stats.h>
+#include <trace.h>
+#include <profile.h>
+#include <report.h>
+#include <lock.h>
+#include <sample.h>
+
+/* States of slot list, the sizes and the modes of the slots live in the same memory */
 slot* slot_list = NULL;
+uint32_t* slot_pages = NULL;
+uint8_t* slot_modes = NULL;
 size_t slot_list_size = 0;
 
+/* Slots count their pages from here, the first chunk sits in the middle of their reach */
+uintptr_t heap_base = 0;
+
+/* The address index lives in the slot list memory, right after the sizes of the slots */
+uint32_t* slot_index = NULL;
+size_t slot_index_capacity = 0;
+
 int slot_count = 0;
 int unused_slots = 0;
 
+/* Placement of page allocations, chosen with FL_GUARD */
+guard_mode guard = GUARD_LEADING;
+
 /* States of bin allocator */
 int number_of_bins = 0;
 size_t threshold = 0; // should be compared with internal size
 
+/* Empty slabs of any bin, the most recently emptied first */
+bin_slab* empty_slabs = NULL;
+bin_slab* empty_slabs_tail = NULL;
+size_t empty_slab_count = 0;
+static uint64_t bin_frees = 0;
+
+/* Empty slabs carved at start, kept beyond BIN_EMPTY_SLABS for the first BIN_EMPTY_DELAY frees */
+static size_t prewarmed_slabs = 0;
+
 /* 
     Since we'll be calling malloc from inside of static functions for example to allocate more 
     slots. We need a flag to mark if the new allocated chunk is for internal use or not!
@@ -25,518 +54,1514 @@ size_t threshold = 0; // should be compared with internal size
 bool is_internal = false;
 bool is_bin_internal = false;
 
-static size_t get_internal_size(bool* use_bin_alloc, size_t user_size);
+static size_t get_internal_size(bool* use_bin_alloc, size_t user_size, size_t alignment);
 static slot* get_slot_prev_to_internal_address(void* addr);
 static slot* get_slot_for_internal_address(void* addr);
 static slot* get_slot_for_user_address(void* addr);
+static bool is_freed_pages(void* addr);
 static bool check_canary_bytes(void* addr, uint8_t canary_byte);
+static bool is_bin_chunk(void* addr);
+
+/* address index of the slots */
+static void slot_list_layout();
+static void set_slot(slot* s, void* internal_address, size_t internal_size, mode mode);
+static void set_slot_user(slot* s, void* user_address, size_t user_size);
+static void clear_slot(slot* s);
+static bool slot_in_reach(void* internal_address, size_t internal_size);
+static void* fl_create_in_reach(size_t size);
+static void index_slot(slot* s);
+static void unindex_slot(slot* s);
+static slot* find_indexed_slot(uintptr_t key, uint32_t kind);
+static uintptr_t slot_key(slot* s, uint32_t kind);
+static size_t slot_index_hash(uintptr_t key);
+static uintptr_t slot_index_key(uint32_t entry);
+static void slot_index_insert(uint32_t entry);
+static void slot_index_remove(uint32_t entry);
 
 /* wrappers */
-static void allow_access_internal();
-static void deny_access_internal();
-static void* pages_alloc(size_t user_size, size_t internal_size);
-static void* bin_page_alloc(size_t user_size, size_t internal_size);
+static size_t pages_alloc(size_t user_size, size_t internal_size, size_t alignment, void** out, size_t n);
+static size_t bin_page_alloc(size_t user_size, size_t internal_size, void** out, size_t n);
 
 static void fl_init();
 static void fl_bin_allocator_init();
-static void* fl_memalign(size_t user_size);
+static void fl_prewarm();
+static size_t fl_prewarm_pages(int ind);
+static void fl_bin_slab_format(bin_slab* slab, uint8_t ind);
+static bin_slab* fl_bin_slab_take(uint8_t ind);
+static bool fl_bin_chunk_free(uintptr_t* chunk, uint8_t ind);
+static void fl_bin_trim();
+static bin_slab** get_bin_list(bin_slab* slab);
+static void slab_push(bin_slab* slab, slab_list list);
+static void slab_unlink(bin_slab* slab);
+static void* fl_memalign(size_t alignment, size_t user_size);
+static bool fl_usable_size(void* addr, size_t* size);
+static void fl_release(void* addr);
+static void fl_release_batch(void** addrs, size_t n);
+static void fl_drain_remote_frees();
+static void fl_fork_prepare();
+static void fl_fork_parent();
+static void fl_fork_child();
+static void fl_release_slot(slot* s);
+#ifndef FL_NO_CHECKS
+static void fl_release_sized(void* addr, size_t size, size_t alignment);
+#endif
+static slot* get_unused_slot();
 static void fl_allocate_more_slots();
 
 void* malloc(size_t size)
+{
+    return fl_allocate(CHUNK_ALIGNMENT, size, __builtin_return_address(0));
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    return fl_allocate(alignment, size, __builtin_return_address(0));
+}
+
+void* calloc(size_t count, size_t size)
 {
     void* allocation = NULL;
-    if (slot_list == NULL)
+
+    if (size && count > SIZE_MAX / size)
     {
-        fl_init();
+        return NULL;
     }
 
-    allocation = fl_memalign(size);
+    /* freed memory is handed out again as it was left */
+    allocation = fl_allocate(CHUNK_ALIGNMENT, count * size, __builtin_return_address(0));
+    if (allocation != NULL)
+    {
+        memset(allocation, 0, count * size);
+    }
     return allocation;
 }
 
-void free(void* addr)
+void* realloc(void* addr, size_t size)
 {
-    size_t page_size = PAGE_SIZE;
-    slot* prev_s = NULL;
-    slot* nxt_s = NULL;
-    slot* s;
+    void* allocation = NULL;
+    size_t old_size = 0;
+    bool known;
 
     if (addr == NULL)
     {
-        // no error
-        return;
+        return fl_allocate(CHUNK_ALIGNMENT, size, __builtin_return_address(0));
     }
 
-    /* Allow access to slot list */
-    allow_access_internal();
+    if (size == 0)
+    {
+        free(addr);
+        return NULL;
+    }
 
-    /* Check if the address is not page-aligned, it should be in bin allocated area */
-    if ((uintptr_t)addr % page_size)
+    /* every buffer lives in its own bin chunk or pages, so it always moves, the new one is taken unlocked to be sampled */
+    allocation = fl_allocate(CHUNK_ALIGNMENT, size, __builtin_return_address(0));
+    if (allocation == NULL)
     {
-        if ((uintptr_t)addr % CHUNK_ALIGNMENT)
-        {
-            fl_error("free(): free of unintialized heap\n");
-        }
+        return NULL;
+    }
 
-        /* get the metadata and check if the chunk is already free */
-        uintptr_t* metadata_ptr = (uintptr_t*)(addr - 2 * CHUNK_ALIGNMENT);
-        uintptr_t metadata = *metadata_ptr;
-        if (!get_bin_alloc_status(metadata))
-        {
-            fl_error("free(): double free of address: %a\n", addr);
-        }
+    /* the buffer must not be released by another thread while it is copied */
+    heap_lock();
 
-        /* check canary bytes */
-        uint8_t ind = *((uint8_t*)addr - CHUNK_ALIGNMENT);
-        if (!check_canary_bytes(get_address(addr, -1*CHUNK_ALIGNMENT), ind))
-        {
-            fl_error("free(): segmentation fault\n");
-        }
+    allow_access_internal();
+    known = fl_usable_size(addr, &old_size);
+    deny_access_internal();
 
-        /* unset the metadata */
-        *metadata_ptr = get_bin_alloc_next(metadata);
-        /* find the extra page */
-        uintptr_t* bin_address = (uintptr_t*)get_address(slot_list[1].internal_address, ind*CHUNK_ALIGNMENT);
-        uintptr_t* link = bin_address;
-        uintptr_t* link_v = (uintptr_t*)(*bin_address);
-        uintptr_t* prev_link = NULL;
-        bool is_prev_blank = true;
+    /* the buffer is left to the caller as it is */
+    if (!known)
+    {
+        free(allocation);
+        heap_unlock();
+        return NULL;
+    }
 
-        while (link_v)
-        {
-            /* at next page */
-            if ((uintptr_t)link_v % page_size == 0)
-            {
-                if (prev_link  && is_prev_blank)
-                {
-                    /* set previous link to this link */
-                    s = get_slot_for_internal_address((void*)(*prev_link));
-                    *prev_link = (uintptr_t)link_v;
+    memcpy(allocation, addr, old_size < size ? old_size : size);
+    free(addr);
 
-                    /* find the allocated bin slot using link address */
-                    if (s->mode != ALLOCATED_BIN_SLOT)
-                    {
-                        fl_error("free(): internal error\n");
-                    }
+    heap_unlock();
+    return allocation;
+}
 
-                    goto coalesce;
-                }
-                prev_link = link;
-                is_prev_blank = true;
-            }
+int posix_memalign(void** addr, size_t alignment, size_t size)
+{
+    void* allocation = NULL;
 
-            if (get_bin_alloc_status(*link_v))
-            {
-                is_prev_blank = false;
-            }
-            link_v = (uintptr_t*)get_bin_alloc_next(*link_v);
-            link = (uintptr_t*)get_bin_alloc_next(*link);
-        }
+    if (alignment % sizeof(void*) || (alignment & (alignment - 1)))
+    {
+        return EINVAL;
+    }
 
-        goto finish;
+    allocation = fl_allocate(alignment, size, __builtin_return_address(0));
+    if (allocation == NULL)
+    {
+        return ENOMEM;
     }
+    *addr = allocation;
+    return 0;
+}
 
-    /* get the slot which is associated with the user address */
-    s = get_slot_for_user_address(addr);
+void*
+fl_allocate(size_t alignment, size_t size, void* caller)
+{
+    void* allocation = NULL;
+    uint64_t start = 0;
+    bool outermost;
+    bool sampled = false;
+    sample_stack stack;
 
-    if (s == NULL)
+    /* unwinding may take the loader lock, so the stack of a sample is taken before the heap */
+    if (instrumented(sample_rate) && heap_lock_depth() == 0)
     {
-        fl_error("free(): free of unintialized heap\n");
+        if (sample_dump_requested)
+        {
+            sample_dump_signaled();
+        }
+        sampled = sample_take(size, caller, &stack);
     }
 
-    if (s->mode == INTERNAL_USE_SLOT && !is_internal)
+    heap_lock();
+    outermost = !is_internal;
+    if (slot_list == NULL)
     {
-        fl_error("free(): how did u get this address??\n");
+        fl_init();
     }
-
-    if (s->mode == FREE_SLOT)
+    if (heap_lock_depth() == 1)
     {
-        fl_error("free(): double free of address: %a\n", s->user_address);
+        fl_drain_remote_frees();
     }
 
-coalesce:
-    /* try to coalesce with the neighbouring slots */
-    prev_s = get_slot_prev_to_internal_address(s->internal_address);
-    nxt_s = get_slot_for_internal_address(get_address(s->internal_address, s->internal_size));
-
-    /* coalesce previous slot */
-    if (prev_s != NULL && prev_s->mode == FREE_SLOT)
+    /* internal requests are part of the user's request, only time the outermost call */
+    if (instrumented(stats) && outermost)
     {
-        prev_s->internal_size = prev_s->internal_size + s->internal_size;
-        prev_s->mode = FREE_SLOT;
-        /* mark previous slot as unused */
-        s->internal_address = s->user_address = 0;
-        s->internal_size = s->user_size = 0;
-        s->mode = IOTA_SLOT;
-
-        s = prev_s;
-        unused_slots++;
+        start = stats_clock();
     }
 
-    /* coalesce next slot */
-    if (nxt_s != NULL && nxt_s->mode == FREE_SLOT)
+    allocation = fl_memalign(alignment, size);
+    if (instrumented(sampled) && allocation)
     {
-        s->internal_size = nxt_s->internal_size + s->internal_size;
-        /* mark next slot as unused */
-        nxt_s->internal_address = nxt_s->user_address = 0;
-        nxt_s->internal_size = nxt_s->user_size = 0;
-        nxt_s->mode = IOTA_SLOT;
-        unused_slots++;
+        sample_record(allocation, size, &stack);
     }
 
-    s->user_address = s->internal_address;
-    s->user_size = s->internal_size;
-    s->mode = FREE_SLOT;
+    if (instrumented(start))
+    {
+        stats_latency(stats->malloc_latency, start);
+    }
+    if (instrumented(trace) && outermost)
+    {
+        trace_append(TRACE_MALLOC, allocation, size);
+    }
 
-    page_deny_access(s->internal_address, s->internal_size);
-finish:
-    /* Revoke access again to protect reads and write on slot list and bin allocator */
-    deny_access_internal();
+    heap_unlock();
+    return allocation;
 }
 
-static void
-fl_init()
+void free(void* addr)
 {
-    size_t page_size = PAGE_SIZE; // in bytes
-    size_t size = MEMORY_CREATION_SIZE; // in bytes
-    size_t slack;
-  
-    slot_list_size = page_size;
+    uint64_t start = 0;
 
-    if (slot_list_size > size)
+    if (addr == NULL)
     {
-        size = slot_list_size;
+        // no error
+        return;
     }
-    /* make size a multiple of page size */
-    if ((slack = size % page_size) != 0)
+
+    if (!heap_trylock())
     {
-        size += page_size - slack;
+        /* another thread works on the heap, leave the buffer to it rather than wait */
+        if (remote_free_push(addr))
+        {
+            if (instrumented(trace))
+            {
+                trace_append(TRACE_FREE, addr, 0);
+            }
+            return;
+        }
+        heap_lock();
+    }
+    if (heap_lock_depth() == 1)
+    {
+        fl_drain_remote_frees();
     }
 
-    /* Ask for a decent amount of memory from the operating system */
-    slot_list = page_create(size);
-    /* Reserve first page for the slots and rest as memory pool */
-    slot_count = page_size / sizeof(slot);
-    /* initialize the slot area */
-    memset(slot_list, 0, slot_list_size);
-
-    unused_slots = slot_count;
-    /* The first slot should always points to the slot list itself */
-    slot_list[0].internal_address = slot_list[0].user_address = (void*)slot_list;
-    slot_list[0].internal_size = slot_list[0].user_size = slot_list_size;
-    slot_list[0].mode = INTERNAL_USE_SLOT;
-    unused_slots--;
-
-    /* The second slot points to the bin allocator */
-    if (size > slot_list_size)
+    if (instrumented(stats) && !is_internal)
     {
-        slot_list[1].internal_address = slot_list[1].user_address = get_address(slot_list[0].internal_address, slot_list[0].internal_size);
-        slot_list[1].internal_size = slot_list[1].user_size = page_size; // dedicate a page for bin allocator
-        slot_list[1].mode = INTERNAL_USE_SLOT;
-        fl_bin_allocator_init();
-        unused_slots--;
+        start = stats_clock();
     }
 
-    /* The third slot points to the rest of the memory pool */
-    if (size > slot_list_size + page_size)
+    if (instrumented(trace) && !is_internal)
     {
-        slot_list[2].internal_address = slot_list[2].user_address = get_address(slot_list[1].internal_address, slot_list[1].internal_size);
-        slot_list[2].internal_size = slot_list[2].user_size = size - (slot_list[0].internal_size + slot_list[1].internal_size);
-        slot_list[2].mode = FREE_SLOT;
-        unused_slots--;
+        trace_append(TRACE_FREE, addr, 0);
     }
 
-    /* disable protection of slot list, only allow access when its being retrieved */
-    page_deny_access(slot_list, size);
-}
+    /* Allow access to slot list */
+    allow_access_internal();
 
-static void
-fl_bin_allocator_init()
-{
-    size_t page_size = PAGE_SIZE; // in bytes
-    size_t chunk_alignment = CHUNK_ALIGNMENT;
-    /* bin size must be less than page size and a multiple of chunk alignment */
+    fl_release(addr);
 
-    number_of_bins = page_size / chunk_alignment;
-    while (number_of_bins && get_bin_size(number_of_bins-1) > page_size)
+    /* Revoke access again to protect reads and write on slot list and bin allocator */
+    deny_access_internal();
+
+    if (instrumented(start))
     {
-        /* make sure the maximum bin size is less than page size */
-        number_of_bins--;
+        stats_latency(stats->free_latency, start);
     }
-    memset(slot_list[1].internal_address, 0, slot_list[1].internal_size);
 
-    /* threshold is the maximum size of the bin */
-    threshold = get_bin_size(number_of_bins - 1);
+    heap_unlock();
 }
 
-// TODO: testing pending
-static void
-fl_allocate_more_slots()
+size_t
+fl_malloc_batch(size_t size, size_t n, void** out)
 {
-    size_t new_size;
-    slot* new_slot_list = NULL;
-    slot* old_slot_list = slot_list;
-    int new_slot_count = 0;
-    size_t page_size = PAGE_SIZE;
+    size_t internal_size = 0;
+    size_t allocated = 0;
+    bool use_bin_alloc = false;
+    uint64_t start = 0;
+    bool sampled = false;
+    sample_stack stack;
 
-    is_internal = true;
-    new_size = slot_list_size + page_size;
-    
-    /* Find a free space of that can accomodate current size and one extra page */
-    new_slot_list = malloc(new_size);
-    
-    /* Copy the previous slot list to new slot list */
-    memset(new_slot_list, 0, new_size);
-    memcpy(new_slot_list, old_slot_list, slot_list_size);
-    
-    /* Update the global states */
-    slot_list = new_slot_list;
-    slot_list_size = new_size;
-    new_slot_count = new_size / sizeof(slot);
-    unused_slots = new_slot_count - (slot_count - unused_slots);
-    slot_count = new_slot_count;
+    /* an empty batch leaves the heap as it is */
+    if (n == 0)
+    {
+        return 0;
+    }
 
-    /* mark the old allocation as free */
-    free(old_slot_list);
-    
-    is_internal = false;
-}
+    /* the batch counts as one allocation of all its bytes, its first buffer stands for it */
+    if (instrumented(sample_rate) && heap_lock_depth() == 0 && size && n <= SIZE_MAX / size)
+    {
+        sampled = sample_take(size * n, __builtin_return_address(0), &stack);
+    }
 
-static void*
-fl_memalign(size_t user_size)
-{
-    size_t internal_size = 0;
-    bool use_bin_alloc = false;
-    /* Initialize malloc data structures */
+    heap_lock();
     if (slot_list == NULL)
     {
         fl_init();
     }
-
-    /* Get the internal size */
-    internal_size = get_internal_size(&use_bin_alloc, user_size);
-    if (!use_bin_alloc)
+    if (heap_lock_depth() == 1)
     {
-        return pages_alloc(user_size, internal_size);
+        fl_drain_remote_frees();
     }
-    else
+
+    if (instrumented(stats))
     {
-        return bin_page_alloc(user_size, internal_size);
+        start = stats_clock();
     }
-}
-
-static void*
-pages_alloc(size_t user_size, size_t internal_size)
-{
-    size_t page_size = PAGE_SIZE;
-    size_t size = MEMORY_CREATION_SIZE; // in bytes
-    slot* s = NULL;
-    size_t slack = 0;
-    int count = 0;
-    slot* empty_slot = NULL;
-    slot* free_fit_slot = NULL;
-    void* user_address = NULL;
 
-    /* Allow access to internal data structures */
-    allow_access_internal();
+    /* the whole batch is carved in one pass over a bin chain or the free slots */
+    internal_size = get_internal_size(&use_bin_alloc, size, CHUNK_ALIGNMENT);
+    if (use_bin_alloc)
+    {
+        allocated = bin_page_alloc(size, internal_size, out, n);
+    }
+    else if (n <= SIZE_MAX / internal_size)
+    {
+        allocated = pages_alloc(size, internal_size, CHUNK_ALIGNMENT, out, n);
+    }
 
-    /* Check if slots are exhausted, atleast 8 unused slots must be present */
-    if (!is_internal && unused_slots <= 8)
+    if (instrumented(sampled) && allocated)
     {
-        fl_allocate_more_slots();
+        sample_record(out[0], size * allocated, &stack);
     }
 
-    /**
-     * Find the free space using best-fit algorithm
-     * 
-     * Only a free slot can become an allocated slot or internal use slot
-     * 
-     * Case 1: One or many free slots
-     * - try to choose the best fit
-     * - if found and slot size > internal size, divide it into two free slots and allocate one
-     * Case 2: No free slot or no fit free slot
-     * - allocate a new chunk by requesting from OS
-     * 
-     * In both the cases we will be needing unused slot, for case 1 we will divide the free slots into
-     * two and use an unused slot to mark it free (while first free slot will be marked allocated), while in
-     * case 2, we will create a new free memory chunk.
-     * 
-     */
-    for (s = slot_list, count = 0; count < slot_count; count++)
+    if (instrumented(start))
     {
-        if (s->mode == FREE_SLOT && s->internal_size >= internal_size) // find best fit slot
-        {
-            if (!free_fit_slot || s->internal_size < free_fit_slot->internal_size)
-            {
-                free_fit_slot = s;
-                /* just in case we get an exact size */
-                if (free_fit_slot->internal_size == internal_size && empty_slot != NULL)
-                {
-                    break;
-                }
-            }
-        }
-        else if (!empty_slot && s->mode == IOTA_SLOT) // get one unused slot (it is guranteed that we get an unused slot)
-        {
-            empty_slot = s;
-        }
-        s++;
+        stats_latency(stats->malloc_latency, start);
     }
-    /* if no free slot found, allocate a new chunk */
-    if (!free_fit_slot)
+    for (size_t i = 0; instrumented(trace) && i < allocated; i++)
     {
-        if (!empty_slot)
-        {
-            fl_error("malloc(): no empty slots found\n"); // TODO: just exit no print
-        }
+        trace_append(TRACE_MALLOC, out[i], size);
+    }
 
-        if (internal_size > size)
-        {
-            size = internal_size;
-        }
-        
-        if ((slack = size % page_size) != 0)
-        {
-            size += page_size - slack;
-        }
-        
-        empty_slot->internal_address = empty_slot->user_address = page_create(size);
-        empty_slot->internal_size = empty_slot->user_size = size;
-        empty_slot->mode = FREE_SLOT;
-        unused_slots--;
-        // TODO: try to coalesce with the previous chunk, when impl free()
-        
-        /* Deny access to newly created free memory */
-        page_deny_access(empty_slot->internal_address, empty_slot->internal_size);
+    heap_unlock();
+    return allocated;
+}
 
-        /* Restore all states that was before memalign */
-        deny_access_internal();
-        /* new free space created, try again */
-        return fl_memalign(user_size);
-    }
+void
+fl_free_batch(void** addrs, size_t n)
+{
+    uint64_t start = 0;
 
-    /* Divide the free space into two */
-    if (free_fit_slot->internal_size > internal_size)
+    heap_lock();
+    if (heap_lock_depth() == 1)
     {
-        empty_slot->internal_address = empty_slot->user_address = get_address(free_fit_slot->internal_address, internal_size);
-        empty_slot->internal_size = empty_slot->user_size = free_fit_slot->internal_size - internal_size;
-        free_fit_slot->internal_size = internal_size;
-        empty_slot->mode = FREE_SLOT;
-        unused_slots--;
+        fl_drain_remote_frees();
     }
 
-    /* Finally set the appropriate user address and size */
-    if (is_internal)
+    if (instrumented(stats))
     {
-        user_address = free_fit_slot->internal_address;
-        /* Set up the live page */
-        page_allow_access(user_address, internal_size);
-        free_fit_slot->mode = (!is_bin_internal) ? INTERNAL_USE_SLOT : ALLOCATED_BIN_SLOT;
+        start = stats_clock();
     }
-    else
+
+    for (size_t i = 0; instrumented(trace) && i < n; i++)
     {
-        user_address = get_address(free_fit_slot->internal_address, page_size); // reserve one page in free page for dead page
-        if (internal_size - page_size > user_size)
+        if (addrs[i] != NULL)
         {
-            /* Set up the live page */
-            page_allow_access(user_address, internal_size - page_size);
+            trace_append(TRACE_FREE, addrs[i], 0);
+        }
+    }
+
+    allow_access_internal();
+    fl_release_batch(addrs, n);
+    deny_access_internal();
+
+    if (instrumented(start))
+    {
+        stats_latency(stats->free_latency, start);
+    }
+
+    heap_unlock();
+}
+
+static void
+fl_release_batch(void** addrs, size_t n)
+{
+    /* the metadata stays open for the whole batch */
+    for (size_t i = 0; i < n; i++)
+    {
+        if (addrs[i] != NULL)
+        {
+            fl_release(addrs[i]);
+        }
+    }
+}
+
+static void
+fl_drain_remote_frees()
+{
+    void* addrs[REMOTE_FREE_BATCH];
+    size_t n;
+
+    if (slot_list == NULL || !remote_free_pending())
+    {
+        return;
+    }
+
+    /* the frees other threads queued while the heap was busy, checked like any other */
+    allow_access_internal();
+    while ((n = remote_free_take(addrs, REMOTE_FREE_BATCH)) > 0)
+    {
+        fl_release_batch(addrs, n);
+    }
+    deny_access_internal();
+}
+
+static void
+fl_release(void* addr)
+{
+    slot* s;
+
+    /* a buffer with an error is left alone, so it is leaked rather than handed out again */
+    if (checked((uintptr_t)addr % CHUNK_ALIGNMENT))
+    {
+        fl_fault(FAULT_INVALID_FREE, addr, "free(): free of unintialized heap at %a\n", addr);
+        return;
+    }
+
+    /* Check if the address is not page-aligned, it should be in bin allocated area */
+    if (is_bin_chunk(addr))
+    {
+        /* get the metadata and check if the chunk is already free */
+        uintptr_t* metadata_ptr = (uintptr_t*)(addr - 2 * CHUNK_ALIGNMENT);
+        uintptr_t metadata = *metadata_ptr;
+        if (checked(!get_bin_alloc_status(metadata)))
+        {
+            fl_fault(FAULT_DOUBLE_FREE, addr, "free(): double free of address: %a\n", addr);
+            return;
+        }
+
+        /* check canary bytes */
+        uint8_t ind = *((uint8_t*)addr - CHUNK_ALIGNMENT);
+        if (checked(!check_canary_bytes(get_address(addr, -1*CHUNK_ALIGNMENT), ind)))
+        {
+            fl_fault(FAULT_CANARY, addr, "free(): canary bytes of %a are corrupted\n", addr);
+            return;
+        }
+
+        if (checked(ind == POOL_CANARY))
+        {
+            fl_fault(FAULT_INVALID_FREE, addr, "free(): %a belongs to a pool, it is freed with fl_pool_free()\n", addr);
+            return;
+        }
+
+        /* give the chunk back to its slab */
+        if (!fl_bin_chunk_free(metadata_ptr, ind))
+        {
+            fl_fault(FAULT_CANARY, addr, "free(): the slab header of %a is corrupted\n", addr);
+            return;
+        }
+        stats_free(ind, get_bin_size(ind));
+        if (instrumented(profile)) profile_chunks(ind, -1);
+        if (instrumented(sample_live)) sample_forget(addr);
+        return;
+    }
+
+    /* get the slot which is associated with the user address */
+    s = get_slot_for_user_address(addr);
+
+    if (s == NULL)
+    {
+        if (checked(is_freed_pages(addr)))
+        {
+            fl_fault(FAULT_DOUBLE_FREE, addr, "free(): double free of address: %a\n", addr);
+            return;
+        }
+        fl_fault(FAULT_INVALID_FREE, addr, "free(): free of unintialized heap at %a\n", addr);
+        return;
+    }
+
+    if (checked(get_slot_mode(s) == INTERNAL_USE_SLOT && !is_internal))
+    {
+        fl_fault(FAULT_INVALID_FREE, addr, "free(): how did u get this address?? %a\n", addr);
+        return;
+    }
+
+    if (checked(get_slot_mode(s) == FREE_SLOT))
+    {
+        fl_fault(FAULT_DOUBLE_FREE, addr, "free(): double free of address: %a\n", addr);
+        return;
+    }
+
+    if (get_slot_mode(s) == ALLOCATED_SLOT)
+    {
+        stats_free(STATS_PAGE_CLASS, get_slot_user_size(s));
+        if (instrumented(sample_live)) sample_forget(addr);
+    }
+
+    fl_release_slot(s);
+}
+
+
+void free_sized(void* addr, size_t size)
+{
+    fl_free_sized(addr, size, CHUNK_ALIGNMENT);
+}
+
+void free_aligned_sized(void* addr, size_t alignment, size_t size)
+{
+    fl_free_sized(addr, size, alignment);
+}
+
+void
+fl_free_sized(void* addr, size_t size, size_t alignment)
+{
+    uint64_t start = 0;
+
+    if (addr == NULL)
+    {
+        return;
+    }
+
+    if (!heap_trylock())
+    {
+        /* like free(), the size is not checked for a queued buffer */
+        if (remote_free_push(addr))
+        {
+            if (instrumented(trace))
+            {
+                trace_append(TRACE_FREE, addr, 0);
+            }
+            return;
+        }
+        heap_lock();
+    }
+    if (heap_lock_depth() == 1)
+    {
+        fl_drain_remote_frees();
+    }
+
+    if (instrumented(stats))
+    {
+        start = stats_clock();
+    }
+
+    if (instrumented(trace))
+    {
+        trace_append(TRACE_FREE, addr, 0);
+    }
+
+    allow_access_internal();
+
+#ifdef FL_NO_CHECKS
+    /* the size only serves to check the buffer */
+    fl_release(addr);
+#else
+    fl_release_sized(addr, size, alignment);
+#endif
+
+    deny_access_internal();
+
+    if (instrumented(start))
+    {
+        stats_latency(stats->free_latency, start);
+    }
+
+    heap_unlock();
+}
+
+#ifndef FL_NO_CHECKS
+static void
+fl_release_sized(void* addr, size_t size, size_t alignment)
+{
+    size_t page_size = PAGE_SIZE;
+    size_t internal_size = 0;
+    bool use_bin_alloc = false;
+    slot* s;
+
+    /* the size tells where the buffer lives, like it did in malloc() */
+    internal_size = get_internal_size(&use_bin_alloc, size, alignment);
+    if (use_bin_alloc)
+    {
+        if ((uintptr_t)addr % CHUNK_ALIGNMENT)
+        {
+            fl_fault(FAULT_INVALID_FREE, addr, "free_sized(): free of unintialized heap at %a\n", addr);
+            return;
+        }
+
+        if (!is_bin_chunk(addr))
+        {
+            fl_fault(FAULT_SIZE_MISMATCH, addr, "free_sized(): size mismatch, %U bytes given for the pages at %a\n",
+                     size, addr);
+            return;
+        }
+
+        uintptr_t* metadata_ptr = (uintptr_t*)(addr - 2 * CHUNK_ALIGNMENT);
+        uintptr_t metadata = *metadata_ptr;
+        if (!get_bin_alloc_status(metadata))
+        {
+            fl_fault(FAULT_DOUBLE_FREE, addr, "free_sized(): double free of address: %a\n", addr);
+            return;
+        }
+
+        uint8_t ind = *((uint8_t*)addr - CHUNK_ALIGNMENT);
+        if (!check_canary_bytes(get_address(addr, -1*CHUNK_ALIGNMENT), ind))
+        {
+            fl_fault(FAULT_CANARY, addr, "free_sized(): canary bytes of %a are corrupted\n", addr);
+            return;
+        }
+
+        if (ind == POOL_CANARY)
+        {
+            fl_fault(FAULT_INVALID_FREE, addr, "free_sized(): %a belongs to a pool, it is freed with fl_pool_free()\n", addr);
+            return;
+        }
+
+        if (ind != get_bin_index(internal_size))
+        {
+            fl_fault(FAULT_SIZE_MISMATCH, addr,
+                     "free_sized(): size mismatch, %U bytes given for the chunk of up to %U bytes at %a\n",
+                     size, get_bin_size(ind) - 2 * CHUNK_ALIGNMENT, addr);
+            return;
+        }
+
+        if (!fl_bin_chunk_free(metadata_ptr, ind))
+        {
+            fl_fault(FAULT_CANARY, addr, "free_sized(): the slab header of %a is corrupted\n", addr);
+            return;
+        }
+        stats_free(ind, get_bin_size(ind));
+        if (instrumented(profile)) profile_chunks(ind, -1);
+        if (instrumented(sample_live)) sample_forget(addr);
+        return;
+    }
+
+    if ((uintptr_t)addr % CHUNK_ALIGNMENT == 0 && is_bin_chunk(addr))
+    {
+        fl_fault(FAULT_SIZE_MISMATCH, addr, "free_sized(): size mismatch, %U bytes given for the chunk at %a\n",
+                 size, addr);
+        return;
+    }
+
+    /* the slot starts one guard page before a leading buffer, or in the first page of a trailing one */
+    s = find_indexed_slot((uintptr_t)addr - GUARD_PAGES * page_size, 0);
+    if (s == NULL || get_slot_user_address(s) != addr)
+    {
+        s = find_indexed_slot((uintptr_t)addr & ~(page_size - 1), 0);
+    }
+    if (s == NULL || get_slot_user_address(s) != addr)
+    {
+        if (is_freed_pages(addr))
+        {
+            fl_fault(FAULT_DOUBLE_FREE, addr, "free_sized(): double free of address: %a\n", addr);
+            return;
+        }
+        fl_fault(FAULT_INVALID_FREE, addr, "free_sized(): free of unintialized heap at %a\n", addr);
+        return;
+    }
+
+    if (get_slot_mode(s) != ALLOCATED_SLOT)
+    {
+        fl_fault(FAULT_DOUBLE_FREE, addr, "free_sized(): double free of address: %a\n", addr);
+        return;
+    }
+
+    if (get_slot_user_size(s) != size)
+    {
+        fl_fault(FAULT_SIZE_MISMATCH, addr, "free_sized(): size mismatch, %U bytes given for the %U byte buffer at %a\n",
+                 size, get_slot_user_size(s), addr);
+        return;
+    }
+
+    stats_free(STATS_PAGE_CLASS, size);
+    if (instrumented(sample_live)) sample_forget(addr);
+    fl_release_slot(s);
+}
+#endif
+
+static void
+fl_release_slot(slot* s)
+{
+    slot* prev_s = NULL;
+    slot* nxt_s = NULL;
+    size_t page_size = PAGE_SIZE;
+    void* internal_address = get_slot_internal_address(s);
+    size_t internal_size = get_slot_internal_size(s);
+
+    if (instrumented(profile)) profile_pages(-(int64_t)(internal_size / page_size));
+
+    /* try to coalesce with the neighbouring slots */
+    prev_s = get_slot_prev_to_internal_address(internal_address);
+    nxt_s = get_slot_for_internal_address(get_address(internal_address, internal_size));
+    unindex_slot(s);
+
+    /* coalesce previous slot */
+    if (prev_s != NULL && get_slot_mode(prev_s) == FREE_SLOT)
+    {
+        unindex_slot(prev_s);
+        internal_address = get_slot_internal_address(prev_s);
+        internal_size += get_slot_internal_size(prev_s);
+        /* mark previous slot as unused */
+        clear_slot(s);
+
+        s = prev_s;
+        unused_slots++;
+    }
+
+    /* coalesce next slot */
+    if (nxt_s != NULL && get_slot_mode(nxt_s) == FREE_SLOT)
+    {
+        unindex_slot(nxt_s);
+        internal_size += get_slot_internal_size(nxt_s);
+        /* mark next slot as unused */
+        clear_slot(nxt_s);
+        unused_slots++;
+    }
+
+    set_slot(s, internal_address, internal_size, FREE_SLOT);
+    index_slot(s);
+
+    page_deny_access(internal_address, internal_size);
+}
+
+static bool
+fl_usable_size(void* addr, size_t* size)
+{
+    slot* s;
+
+    if (checked((uintptr_t)addr % CHUNK_ALIGNMENT))
+    {
+        fl_fault(FAULT_INVALID_FREE, addr, "realloc(): free of unintialized heap at %a\n", addr);
+        return false;
+    }
+
+    if (is_bin_chunk(addr))
+    {
+        uint8_t ind = *((uint8_t*)addr - CHUNK_ALIGNMENT);
+        if (checked(ind == POOL_CANARY && check_canary_bytes(get_address(addr, -1*CHUNK_ALIGNMENT), ind)))
+        {
+            fl_fault(FAULT_INVALID_FREE, addr, "realloc(): %a belongs to a pool, it cannot be reallocated\n", addr);
+            return false;
+        }
+        if (checked(ind >= number_of_bins || !check_canary_bytes(get_address(addr, -1*CHUNK_ALIGNMENT), ind)))
+        {
+            fl_fault(FAULT_CANARY, addr, "realloc(): canary bytes of %a are corrupted\n", addr);
+            return false;
+        }
+        if (checked(!get_bin_alloc_status(*(uintptr_t*)(addr - 2 * CHUNK_ALIGNMENT))))
+        {
+            fl_fault(FAULT_DOUBLE_FREE, addr, "realloc(): reallocation of the freed address: %a\n", addr);
+            return false;
+        }
+        *size = get_bin_size(ind) - 2 * CHUNK_ALIGNMENT;
+        return true;
+    }
+
+    s = get_slot_for_user_address(addr);
+    if (checked(s == NULL && is_freed_pages(addr)))
+    {
+        fl_fault(FAULT_DOUBLE_FREE, addr, "realloc(): reallocation of the freed address: %a\n", addr);
+        return false;
+    }
+    if (s == NULL || checked(get_slot_mode(s) != ALLOCATED_SLOT))
+    {
+        fl_fault(FAULT_INVALID_FREE, addr, "realloc(): free of unintialized heap at %a\n", addr);
+        return false;
+    }
+    *size = get_slot_user_size(s);
+    return true;
+}
+
+static void
+fl_init()
+{
+    size_t page_size = PAGE_SIZE; // in bytes
+    size_t size = MEMORY_CREATION_SIZE; // in bytes
+    size_t slack;
+
+#ifdef FL_PAGE_SIZE
+    /* every page computation relies on the page size of the build */
+    if (page_size_query() != page_size)
+    {
+        fl_error("fl_init(): built for %U byte pages, the system uses %U byte pages\n", page_size, system_page_size);
+    }
+#endif
+
+    report_init();
+
+    /* publish live stats, record a trace and a profile if asked for */
+#ifndef FL_NO_CHECKS
+    stats_init();
+    trace_init();
+    profile_init();
+    sample_init();
+#endif
+
+#ifndef FL_NO_PROTECT
+    if (getenv(GUARD_ENV) != NULL && strcmp(getenv(GUARD_ENV), "trailing") == 0)
+    {
+        guard = GUARD_TRAILING;
+    }
+#endif
+  
+    slot_list_size = page_size;
+
+    /* reserve the pool and the slots the previous run peaked at, bin pages included */
+    if (instrumented(profile_previous))
+    {
+        slot_list_size = fl_prewarm_pages(-1);
+        if ((size_t)profile_previous->peak_slots > slot_list_size)
+        {
+            slot_list_size = profile_previous->peak_slots;
+        }
+        slot_list_size = (slot_list_size + 64) * SLOT_BYTES;
+        if ((slack = slot_list_size % page_size) != 0)
+        {
+            slot_list_size += page_size - slack;
+        }
+        if (slot_list_size + page_size + profile_previous->peak_pages * page_size > size)
+        {
+            size = slot_list_size + page_size + profile_previous->peak_pages * page_size;
+        }
+    }
+
+    if (slot_list_size > size)
+    {
+        size = slot_list_size;
+    }
+    /* make size a multiple of page size */
+    if ((slack = size % page_size) != 0)
+    {
+        size += page_size - slack;
+    }
+
+    /* Ask for a decent amount of memory from the operating system */
+    slot_list = page_create(size);
+    /* the slots reach as far below the first chunk as above it */
+    if ((uintptr_t)slot_list > ((uintptr_t)UINT32_MAX / 2) * page_size)
+    {
+        heap_base = (uintptr_t)slot_list - ((uintptr_t)UINT32_MAX / 2) * page_size;
+    }
+    /* initialize the slot area */
+    memset(slot_list, 0, slot_list_size);
+    /* Reserve first page for the slots and their index, rest as memory pool */
+    slot_list_layout();
+
+    unused_slots = slot_count;
+    /* The first slot should always points to the slot list itself */
+    set_slot(&slot_list[0], slot_list, slot_list_size, INTERNAL_USE_SLOT);
+    unused_slots--;
+
+    /* The second slot points to the bin allocator */
+    if (size > slot_list_size)
+    {
+        set_slot(&slot_list[1], get_address(slot_list, slot_list_size), page_size, INTERNAL_USE_SLOT); // dedicate a page for bin allocator
+        fl_bin_allocator_init();
+        unused_slots--;
+    }
+
+    /* The third slot points to the rest of the memory pool */
+    if (size > slot_list_size + page_size)
+    {
+        set_slot(&slot_list[2], get_address(slot_list, slot_list_size + page_size), size - (slot_list_size + page_size), FREE_SLOT);
+        unused_slots--;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (slot_modes[i] != IOTA_SLOT)
+        {
+            index_slot(&slot_list[i]);
+        }
+    }
+
+    /* disable protection of slot list, only allow access when its being retrieved */
+    page_deny_access(slot_list, size);
+
+    if (instrumented(profile)) profile_pages(slot_list_size / page_size);
+    if (instrumented(profile_previous))
+    {
+        fl_prewarm();
+    }
+
+    /* last, registering may allocate from the heap that is now set up */
+    pthread_atfork(fl_fork_prepare, fl_fork_parent, fl_fork_child);
+}
+
+/**
+ * Hold the heap across fork(), so that the child does not inherit it in the middle
+ * of an operation of another thread or locked by a thread it does not have
+ */
+static void
+fl_fork_prepare()
+{
+    heap_lock();
+    if (heap_lock_depth() == 1)
+    {
+        fl_drain_remote_frees();
+    }
+}
+
+static void
+fl_fork_parent()
+{
+    heap_unlock();
+}
+
+static void
+fl_fork_child()
+{
+    heap_lock_reset();
+}
+
+static size_t
+fl_prewarm_pages(int ind)
+{
+    size_t page_size = PAGE_SIZE;
+    size_t pages = 0;
+    size_t chunks;
+
+    /* the pages a bin, or every bin for -1, needs for the peak of the previous run */
+    for (int i = (ind < 0 ? 0 : ind); i < BIN_MAX_COUNT && get_bin_size(i) <= page_size - BIN_SLAB_HEADER; i++)
+    {
+        if (profile_previous->peak_chunks[i] > 0)
+        {
+            chunks = get_bin_chunks(i, page_size);
+            pages += (profile_previous->peak_chunks[i] + chunks - 1) / chunks;
+        }
+        if (ind >= 0)
+        {
+            break;
+        }
+    }
+    return pages;
+}
+
+static void
+fl_prewarm()
+{
+    size_t page_size = PAGE_SIZE;
+    void* spans[PREWARM_BATCH];
+    size_t pages;
+    size_t n;
+
+    allow_access_internal();
+
+    /* the bin pages are carved from the pool in batches and wait as empty slabs, formatted for their bin */
+    for (int ind = 0; ind < number_of_bins; ind++)
+    {
+        for (pages = fl_prewarm_pages(ind); pages; pages -= n)
+        {
+            n = pages < PREWARM_BATCH ? pages : PREWARM_BATCH;
+            while (unused_slots <= (int)n + 8)
+            {
+                fl_allocate_more_slots();
+            }
+
+            is_internal = true;
+            is_bin_internal = true;
+            pages_alloc(page_size, page_size, CHUNK_ALIGNMENT, spans, n);
+            for (size_t i = 0; i < n; i++)
+            {
+                fl_bin_slab_format((bin_slab*)spans[i], ind);
+                ((bin_slab*)spans[i])->empty_since = bin_frees;
+                slab_push((bin_slab*)spans[i], SLAB_EMPTY);
+            }
+            prewarmed_slabs += n;
+            is_internal = false;
+            is_bin_internal = false;
+        }
+    }
+
+    deny_access_internal();
+}
+
+static void
+fl_bin_allocator_init()
+{
+    size_t page_size = PAGE_SIZE; // in bytes
+    size_t chunk_alignment = CHUNK_ALIGNMENT;
+    /* bin size must fit a page after the slab header and be a multiple of chunk alignment */
+
+    number_of_bins = page_size / chunk_alignment;
+    /* the bin index is stored in a canary byte */
+    if (number_of_bins > BIN_MAX_COUNT)
+    {
+        number_of_bins = BIN_MAX_COUNT;
+    }
+    while (number_of_bins && get_bin_size(number_of_bins-1) > page_size - BIN_SLAB_HEADER)
+    {
+        /* make sure a slab holds at least one chunk of the largest bin */
+        number_of_bins--;
+    }
+    memset(get_slot_internal_address(&slot_list[1]), 0, get_slot_internal_size(&slot_list[1]));
+
+    /* threshold is the maximum size of the bin */
+    threshold = get_bin_size(number_of_bins - 1);
+}
+
+// TODO: testing pending
+static void
+fl_allocate_more_slots()
+{
+    size_t new_size;
+    slot* new_slot_list = NULL;
+    slot* old_slot_list = slot_list;
+    uint32_t* old_slot_pages = slot_pages;
+    uint8_t* old_slot_modes = slot_modes;
+    int old_slot_count = slot_count;
+    int used_slots = 0;
+    size_t page_size = PAGE_SIZE;
+
+    is_internal = true;
+    new_size = slot_list_size + page_size;
+    
+    /* Find a free space of that can accomodate current size and one extra page, malloc() is never re-entered */
+    pages_alloc(new_size, new_size, CHUNK_ALIGNMENT, (void**)&new_slot_list, 1);
+    used_slots = slot_count - unused_slots;
+    
+    /* Update the global states */
+    slot_list = new_slot_list;
+    slot_list_size = new_size;
+    slot_list_layout();
+
+    /* Copy the previous slots array by array, the index is rebuilt for the new capacity */
+    memset(new_slot_list, 0, new_size);
+    memcpy(slot_list, old_slot_list, old_slot_count * sizeof(slot));
+    memcpy(slot_pages, old_slot_pages, old_slot_count * sizeof(uint32_t));
+    memcpy(slot_modes, old_slot_modes, old_slot_count * sizeof(uint8_t));
+
+    unused_slots = slot_count - used_slots;
+    for (int i = 0; i < slot_count; i++)
+    {
+        if (slot_modes[i] != IOTA_SLOT)
+        {
+            index_slot(&slot_list[i]);
+        }
+    }
+
+    /* mark the old allocation as free */
+    fl_release(old_slot_list);
+    
+    is_internal = false;
+}
+
+static void*
+fl_memalign(size_t alignment, size_t user_size)
+{
+    size_t internal_size = 0;
+    bool use_bin_alloc = false;
+    void* user_address = NULL;
+    /* Initialize malloc data structures */
+    if (slot_list == NULL)
+    {
+        fl_init();
+    }
+
+    /* an alignment beyond a page is served from pages with up to alignment - PAGE_SIZE bytes more */
+    if (alignment == 0 || (alignment & (alignment - 1)) || alignment > SIZE_MAX / 4 || user_size > SIZE_MAX / 4)
+    {
+        return NULL;
+    }
+
+    /* Get the internal size */
+    internal_size = get_internal_size(&use_bin_alloc, user_size, alignment);
+    if (!use_bin_alloc)
+    {
+        pages_alloc(user_size, internal_size, alignment, &user_address, 1);
+    }
+    else
+    {
+        bin_page_alloc(user_size, internal_size, &user_address, 1);
+    }
+    return user_address;
+}
+
+static size_t
+pages_alloc(size_t user_size, size_t internal_size, size_t alignment, void** out, size_t n)
+{
+    size_t page_size = PAGE_SIZE;
+    size_t size = MEMORY_CREATION_SIZE; // in bytes
+    size_t pad = alignment > page_size ? alignment - page_size : 0;
+    size_t wanted = (internal_size + pad) * n;
+    size_t wanted_pages = wanted / page_size;
+    slot* s = NULL;
+    slot* nxt_s = NULL;
+    size_t slack = 0;
+    int count = 0;
+    slot* empty_slot = NULL;
+    slot* free_fit_slot = NULL;
+    void* user_address = NULL;
+    void* chunk = NULL;
+
+    /* Allow access to internal data structures */
+    allow_access_internal();
+
+    /* Check if slots are exhausted, atleast 8 unused slots must be present besides one per span, two when padded */
+    while (!is_internal && unused_slots <= (pad ? 2 : 1) * (int)n + 8)
+    {
+        fl_allocate_more_slots();
+    }
+
+retry:
+    /**
+     * Find the free space using best-fit algorithm
+     * 
+     * Only a free slot can become an allocated slot or internal use slot
+     * 
+     * Case 1: One or many free slots
+     * - try to choose the best fit
+     * - if found and slot size > internal size, divide it into two free slots and allocate one
+     * Case 2: No free slot or no fit free slot
+     * - allocate a new chunk by requesting from OS
+     * 
+     * In both the cases we will be needing unused slot, for case 1 we will divide the free slots into
+     * two and use an unused slot to mark it free (while first free slot will be marked allocated), while in
+     * case 2, we will create a new free memory chunk.
+     * 
+     * A batch looks for one free slot holding all of its spans and carves them one after the other.
+     * The scan reads the modes and the sizes of the slots alone.
+     */
+    for (count = 0; count < slot_count; count++)
+    {
+        if (slot_modes[count] == FREE_SLOT && slot_pages[count] >= wanted_pages) // find best fit slot
+        {
+            if (!free_fit_slot || slot_pages[count] < slot_pages[get_slot_number(free_fit_slot)])
+            {
+                free_fit_slot = &slot_list[count];
+                /* just in case we get an exact size */
+                if (slot_pages[count] == wanted_pages && empty_slot != NULL)
+                {
+                    break;
+                }
+            }
+        }
+        else if (!empty_slot && slot_modes[count] == IOTA_SLOT) // get one unused slot (it is guranteed that we get an unused slot)
+        {
+            empty_slot = &slot_list[count];
+        }
+    }
+    /* if no free slot found, allocate a new chunk */
+    if (!free_fit_slot)
+    {
+        if (!empty_slot)
+        {
+            fl_error("malloc(): no empty slots found\n"); // TODO: just exit no print
+        }
+
+        if (wanted > size)
+        {
+            size = wanted;
+        }
+        
+        if ((slack = size % page_size) != 0)
+        {
+            size += page_size - slack;
+        }
+        
+        chunk = fl_create_in_reach(size);
+        /* Deny access to newly created free memory */
+        page_deny_access(chunk, size);
+
+        /* coalesce with the previous chunk if the new memory extends it */
+        s = get_slot_prev_to_internal_address(chunk);
+        if (s != NULL && get_slot_mode(s) == FREE_SLOT)
+        {
+            unindex_slot(s);
+            set_slot(s, get_slot_internal_address(s), get_slot_internal_size(s) + size, FREE_SLOT);
+            index_slot(s);
+        }
+        else
+        {
+            set_slot(empty_slot, chunk, size, FREE_SLOT);
+            index_slot(empty_slot);
+            unused_slots--;
+            s = empty_slot;
+        }
+
+        /* and with the next one if it starts free, as it does after the pages before an alignment were given back */
+        nxt_s = get_slot_for_internal_address(get_address(chunk, size));
+        if (nxt_s != NULL && get_slot_mode(nxt_s) == FREE_SLOT)
+        {
+            unindex_slot(s);
+            unindex_slot(nxt_s);
+            set_slot(s, get_slot_internal_address(s), get_slot_internal_size(s) + get_slot_internal_size(nxt_s), FREE_SLOT);
+            clear_slot(nxt_s);
+            index_slot(s);
+            unused_slots++;
+        }
+
+        /* new free space created, try again */
+        empty_slot = NULL;
+        goto retry;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        s = NULL;
+
+        /* an alignment beyond a page gives the pages before its boundary back as free space */
+        if (pad)
+        {
+            uintptr_t start = (uintptr_t)get_slot_internal_address(free_fit_slot);
+            size_t lead = (guard == GUARD_LEADING) ? GUARD_PAGES * page_size : 0;
+            size_t front = ((start + lead + alignment - 1) & ~(alignment - 1)) - lead - start;
+
+            if (front)
+            {
+                if (empty_slot == NULL)
+                {
+                    empty_slot = get_unused_slot();
+                }
+                unindex_slot(free_fit_slot);
+                set_slot(empty_slot, (void*)start, front, FREE_SLOT);
+                set_slot(free_fit_slot, (void*)(start + front), get_slot_internal_size(free_fit_slot) - front, FREE_SLOT);
+                index_slot(free_fit_slot);
+                index_slot(empty_slot);
+                unused_slots--;
+                empty_slot = NULL;
+            }
+        }
+
+        /* Divide the free space into two, the rest holds the following spans */
+        if (get_slot_internal_size(free_fit_slot) > internal_size)
+        {
+            if (empty_slot == NULL)
+            {
+                empty_slot = get_unused_slot();
+            }
+            unindex_slot(free_fit_slot);
+            set_slot(empty_slot, get_address(get_slot_internal_address(free_fit_slot), internal_size),
+                     get_slot_internal_size(free_fit_slot) - internal_size, FREE_SLOT);
+            set_slot(free_fit_slot, get_slot_internal_address(free_fit_slot), internal_size, FREE_SLOT);
+            index_slot(free_fit_slot);
+            index_slot(empty_slot);
+            unused_slots--;
+            s = empty_slot;
+            empty_slot = NULL;
+        }
+
+        /* Finally set the appropriate user address and size */
+        if (is_internal)
+        {
+            user_address = get_slot_internal_address(free_fit_slot);
+            /* Set up the live page */
+            page_allow_access(user_address, internal_size);
+            slot_modes[get_slot_number(free_fit_slot)] = (!is_bin_internal) ? INTERNAL_USE_SLOT : ALLOCATED_BIN_SLOT;
+        }
+        else if (guard == GUARD_TRAILING)
+        {
+            /* the buffer ends at the dead page, as far as the alignment allows */
+            user_address = get_address(get_slot_internal_address(free_fit_slot), internal_size - page_size);
+            user_address = (void*)(((uintptr_t)user_address - user_size) & ~(alignment < CHUNK_ALIGNMENT ? CHUNK_ALIGNMENT - 1 : alignment - 1));
+            page_allow_access(get_slot_internal_address(free_fit_slot), internal_size - page_size);
+            /* tell this buffer apart from a bin chunk, which has its bin index there */
+            if ((uintptr_t)user_address % page_size)
+            {
+                memset(get_address(user_address, -1*CHUNK_ALIGNMENT), GUARD_CANARY, CHUNK_ALIGNMENT);
+            }
+            slot_modes[get_slot_number(free_fit_slot)] = ALLOCATED_SLOT;
+            stats_malloc(STATS_PAGE_CLASS, user_size);
+        }
+        else
+        {
+            user_address = get_address(get_slot_internal_address(free_fit_slot), GUARD_PAGES * page_size); // reserve one page in free page for dead page
+            /* Set up the live pages, they hold at least user_size bytes */
+            page_allow_access(user_address, internal_size - GUARD_PAGES * page_size);
+            slot_modes[get_slot_number(free_fit_slot)] = ALLOCATED_SLOT;
+            stats_malloc(STATS_PAGE_CLASS, user_size);
+        }
+        set_slot_user(free_fit_slot, user_address, user_size);
+        out[i] = user_address;
+        if (instrumented(profile)) profile_pages(internal_size / page_size);
+
+        free_fit_slot = s;
+    }
+
+    if (instrumented(profile)) profile_slots(slot_count - unused_slots);
+
+    /* Revoke access again to protect reads and write on slot list and bin allocator */
+    deny_access_internal();
+
+    return n;
+}
+
+static size_t
+bin_page_alloc(size_t user_size, size_t internal_size, void** out, size_t n)
+{
+    uint8_t ind = -1;
+    bin_slab* slab = NULL;
+    uintptr_t* chunk = NULL;
+    size_t taken = 0;
+
+    allow_access_internal();
+    /* get bin allocator index using internal_size */
+    ind = get_bin_index(internal_size);
+
+    while (taken < n)
+    {
+        /* the list of a bin only holds slabs with free chunks */
+        slab = *(bin_slab**)get_address(get_slot_internal_address(&slot_list[1]), ind * CHUNK_ALIGNMENT);
+        if (slab == NULL)
+        {
+            slab = fl_bin_slab_take(ind);
+        }
+
+        while (slab->free && taken < n)
+        {
+            chunk = (uintptr_t*)slab->free;
+            slab->free = get_bin_alloc_next(*chunk);
+            *chunk = 1UL;
+            slab->live++;
+            out[taken++] = get_address((void*)chunk, 2*CHUNK_ALIGNMENT);
+            stats_malloc(ind, internal_size);
+            if (instrumented(profile)) profile_chunks(ind, 1);
+        }
+
+        /* a full slab leaves the list until one of its chunks is freed */
+        if (slab->free == 0)
+        {
+            slab_unlink(slab);
         }
-        free_fit_slot->mode = ALLOCATED_SLOT;
     }
-    free_fit_slot->user_address = user_address;
-    free_fit_slot->user_size = user_size;
 
-    /* Revoke access again to protect reads and write on slot list and bin allocator */
     deny_access_internal();
+    return taken;
+}
+
+static bin_slab*
+fl_bin_slab_take(uint8_t ind)
+{
+    size_t page_size = PAGE_SIZE;
+    bin_slab* slab = empty_slabs;
+
+    /* an empty slab of any bin is reused before the pool is asked for a page */
+    if (slab != NULL)
+    {
+        slab_unlink(slab);
+        if (slab->ind != ind)
+        {
+            fl_bin_slab_format(slab, ind);
+        }
+        slab_push(slab, SLAB_PARTIAL);
+        return slab;
+    }
+
+    /* internal requests skip the slot check in pages_alloc, so top up the slots here */
+    if (unused_slots <= 8)
+    {
+        fl_allocate_more_slots();
+    }
+
+    // request a page with internal privilege
+    is_internal = true;
+    is_bin_internal = true;
 
-    return user_address;
+    pages_alloc(page_size, page_size, CHUNK_ALIGNMENT, (void**)&slab, 1);
+    fl_bin_slab_format(slab, ind);
+    slab_push(slab, SLAB_PARTIAL);
+
+    // revoke internal privilege
+    is_internal = false;
+    is_bin_internal = false;
+    return slab;
 }
 
-static void*
-bin_page_alloc(size_t user_size, size_t internal_size)
+static void
+fl_bin_slab_format(bin_slab* slab, uint8_t ind)
 {
-    uint8_t ind = -1;
-    void* user_address = NULL;
-    uintptr_t* bin_list_addr = NULL;
-    uintptr_t* link = NULL;
-    uintptr_t metadata = 0;
-    int chunks = 0;
     size_t page_size = PAGE_SIZE;
-    
-    allow_access_internal();
-    /* get bin allocator index using internal_size */
-    ind = get_bin_index(internal_size);
-    /* if not available, request a size of a page and divide it into (index+3)*16 chunks */
-    bin_list_addr = (uintptr_t*)get_address(slot_list[1].internal_address, ind * CHUNK_ALIGNMENT);
-    link = bin_list_addr;
-    if (!(*bin_list_addr))
-    {
-demand:
-        // request a page with internal privilege
-        is_internal = true;
-        is_bin_internal = true;
-
-        void* start = malloc(page_size);
-        memset(start, 0, page_size);
-        /* Divide the new chunk into bins */
-        chunks = page_size / internal_size;
-        uintptr_t bound = (uintptr_t)get_address(start, page_size);
-        for (int i = 0; i < chunks; i++)
-        {
-            void* bin_cur = get_address(start, i*internal_size);
-            void* bin_nxt = get_address(start, (i+1)*internal_size);
-            /* set the address of next bin in metadata */
-            if ((uintptr_t)bin_nxt < bound)
-            {
-                *((uintptr_t*)bin_cur) = (uintptr_t)bin_nxt;
-            }
-            /* set the canary bytes */
-            memset(get_address(bin_cur, CHUNK_ALIGNMENT), ind, CHUNK_ALIGNMENT);
+    size_t internal_size = get_bin_size(ind);
+    size_t chunks = get_bin_chunks(ind, page_size);
+    size_t first = get_bin_first(ind, page_size);
+    void* bin_cur = NULL;
+
+    memset(slab, 0, page_size);
+    slab->chunks = chunks;
+    slab->ind = ind;
+    slab->free = (uintptr_t)get_address(slab, first);
+
+    /* Divide the page after the header into bins */
+    for (size_t i = 0; i < chunks; i++)
+    {
+        bin_cur = get_address(slab, first + i*internal_size);
+        /* every chunk is free, the last one ends the free list of the slab */
+        if (i + 1 < chunks)
+        {
+            *((uintptr_t*)bin_cur) = (uintptr_t)get_address(bin_cur, internal_size);
         }
+        /* set the canary bytes */
+        memset(get_address(bin_cur, CHUNK_ALIGNMENT), ind, CHUNK_ALIGNMENT);
+    }
+}
+
+static bool
+fl_bin_chunk_free(uintptr_t* chunk, uint8_t ind)
+{
+    size_t page_size = PAGE_SIZE;
+    bin_slab* slab = (bin_slab*)((uintptr_t)chunk & ~(page_size - 1));
 
-        // restore the state of the chunk by just modifying the address
-        *link = (uintptr_t)start | (*link & 1);
-        // revoke internal privilege
-        is_internal = false;
-        is_bin_internal = false;
+    /* the chunk checks passed, the header of its slab must agree with them */
+    if (checked(slab->ind != ind || slab->live == 0 || slab->list > SLAB_EMPTY))
+    {
+        return false;
     }
 
-    /* find a free bin slot */
-    uintptr_t* ptr = (uintptr_t*)(*bin_list_addr);
-    metadata = *ptr;
-    if (metadata == 0)
+    *chunk = slab->free;
+    slab->free = (uintptr_t)chunk;
+    slab->live--;
+    bin_frees++;
+
+    if (slab->live == 0)
     {
-        fl_error("bin allocator not found");
+        /* unlinked in O(1) and parked, a burst of frees does not hand pages straight back */
+        slab_unlink(slab);
+        slab->empty_since = bin_frees;
+        slab_push(slab, SLAB_EMPTY);
     }
-    
-    do {
-        link = ptr;
-        // check if the bin is free
-        if (!get_bin_alloc_status(metadata))
+    else if (slab->list == SLAB_UNLISTED)
+    {
+        slab_push(slab, SLAB_PARTIAL);
+    }
+
+    fl_bin_trim();
+    return true;
+}
+
+static void
+fl_bin_trim()
+{
+    bin_slab* slab;
+    slot* s;
+    size_t kept = BIN_EMPTY_SLABS;
+
+    /* the prewarmed slabs wait for the run to start before the usual bound applies */
+    if (bin_frees <= BIN_EMPTY_DELAY)
+    {
+        kept += prewarmed_slabs;
+    }
+
+    /* the slabs empty for longest go back to the pool first */
+    while ((slab = empty_slabs_tail) != NULL &&
+           (empty_slab_count > kept || bin_frees - slab->empty_since > BIN_EMPTY_DELAY))
+    {
+        s = get_slot_for_internal_address(slab);
+        if (s == NULL || get_slot_mode(s) != ALLOCATED_BIN_SLOT)
         {
-            user_address = get_address((void*)ptr, 2*CHUNK_ALIGNMENT);
-            *ptr = metadata | 1UL;
-            goto finish;
+            fl_error("free(): internal error\n");
         }
 
-        ptr = (uintptr_t*)get_bin_alloc_next(metadata);
-        metadata = *ptr;
+        slab_unlink(slab);
+        fl_release_slot(s);
     }
-    while(metadata);
-    goto demand;
+}
 
-finish:
-    deny_access_internal();
-    return user_address;
+static bin_slab**
+get_bin_list(bin_slab* slab)
+{
+    if (slab->list == SLAB_EMPTY)
+    {
+        return &empty_slabs;
+    }
+    /* the heads of the bin lists live in the bin allocator page */
+    return (bin_slab**)get_address(get_slot_internal_address(&slot_list[1]), slab->ind * CHUNK_ALIGNMENT);
+}
+
+static void
+slab_push(bin_slab* slab, slab_list list)
+{
+    bin_slab** head;
+
+    slab->list = list;
+    head = get_bin_list(slab);
+    slab->prev = NULL;
+    slab->next = *head;
+    if (*head != NULL)
+    {
+        (*head)->prev = slab;
+    }
+    else if (list == SLAB_EMPTY)
+    {
+        empty_slabs_tail = slab;
+    }
+    *head = slab;
+
+    if (list == SLAB_EMPTY)
+    {
+        empty_slab_count++;
+    }
+}
+
+static void
+slab_unlink(bin_slab* slab)
+{
+    bin_slab** head;
+
+    if (slab->list == SLAB_UNLISTED)
+    {
+        return;
+    }
+
+    head = get_bin_list(slab);
+    if (slab->prev != NULL)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        *head = slab->next;
+    }
+    if (slab->next != NULL)
+    {
+        slab->next->prev = slab->prev;
+    }
+    else if (slab->list == SLAB_EMPTY)
+    {
+        empty_slabs_tail = slab->prev;
+    }
+
+    if (slab->list == SLAB_EMPTY)
+    {
+        empty_slab_count--;
+    }
+    slab->prev = slab->next = NULL;
+    slab->list = SLAB_UNLISTED;
 }
 
 static size_t
-get_internal_size(bool* use_bin_alloc, size_t user_size)
+get_internal_size(bool* use_bin_alloc, size_t user_size, size_t alignment)
 {
     size_t internal_size = 0;
     size_t slack;
+    int ind;
     size_t page_size = PAGE_SIZE;
-    int alignment = CHUNK_ALIGNMENT;
 
     /* because user size will always be page-size multiple */
     if (is_internal) {
@@ -548,10 +1573,16 @@ get_internal_size(bool* use_bin_alloc, size_t user_size)
         return user_size;
     }
 
+    /* every allocation gets a distinct address, even an empty one */
+    if (user_size == 0)
+    {
+        user_size = 1;
+    }
+
     /* align user size with the defined alignment of malloc */
-    if ((slack = user_size % alignment) != 0)
+    if ((slack = user_size % CHUNK_ALIGNMENT) != 0)
     {
-        user_size += alignment - slack;
+        user_size += CHUNK_ALIGNMENT - slack;
     }
 
     if (user_size <= (threshold - 2 * CHUNK_ALIGNMENT))
@@ -562,12 +1593,25 @@ get_internal_size(bool* use_bin_alloc, size_t user_size)
         {
             internal_size += CHUNK_ALIGNMENT - slack;
         }
-        *use_bin_alloc = true;
-        return internal_size;
+
+        /* a stricter alignment takes the first bin large enough whose chunks all have it */
+        for (ind = get_bin_index(internal_size); alignment > CHUNK_ALIGNMENT && ind < number_of_bins; ind++)
+        {
+            if (get_bin_size(ind) % alignment == 0 &&
+                (get_bin_first(ind, page_size) + 2 * CHUNK_ALIGNMENT) % alignment == 0)
+            {
+                break;
+            }
+        }
+        if (ind < number_of_bins)
+        {
+            *use_bin_alloc = true;
+            return alignment > CHUNK_ALIGNMENT ? get_bin_size(ind) : internal_size;
+        }
     }
 
     /* Add space for guard page in front of user space */
-    internal_size = user_size + page_size;
+    internal_size = user_size + GUARD_PAGES * page_size;
     if ((slack = internal_size % page_size) != 0)
     {
         internal_size += page_size - slack;
@@ -579,59 +1623,353 @@ get_internal_size(bool* use_bin_alloc, size_t user_size)
 static slot*
 get_slot_for_user_address(void* addr)
 {
+    size_t page_size = PAGE_SIZE;
     slot* s = NULL;
-    int count = 0;
 
-    /* get the slot */
-    for (s = slot_list, count = slot_count; count; count--)
+    /* user pages start one guard page after the slot, trailing ones and everything else in its first page */
+    s = find_indexed_slot((uintptr_t)addr - GUARD_PAGES * page_size, 0);
+    if (s != NULL && get_slot_user_address(s) == addr)
     {
-        if (s->user_address == addr && !(s->mode == IOTA_SLOT))
-        {
-            return s;
-        }
-        s++;
+        return s;
+    }
+
+    s = find_indexed_slot((uintptr_t)addr & ~(page_size - 1), 0);
+    if (s != NULL && get_slot_user_address(s) == addr)
+    {
+        return s;
     }
 
     return NULL;
 }
 
+/**
+ * Tell whether an address lies in a free span, where the pages of a freed buffer go
+ *
+ * The slot of the buffer was cleared or merged with its free neighbours, so no
+ * key of the index leads to it anymore: the free slots are scanned. Only the error
+ * path of a free pays for it.
+ */
+static bool
+is_freed_pages(void* addr)
+{
+    slot* s = slot_list;
+
+    for (int count = 0; count < slot_count; count++, s++)
+    {
+        if (slot_modes[count] == FREE_SLOT && (uintptr_t)addr >= (uintptr_t)get_slot_internal_address(s) &&
+            (uintptr_t)addr < (uintptr_t)get_slot_internal_address(s) + get_slot_internal_size(s))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 static slot*
 get_slot_prev_to_internal_address(void* addr)
 {
-    slot* s = slot_list;
-    int count = 0;
+    return find_indexed_slot((uintptr_t)addr, 1);
+}
+
+static slot*
+get_slot_for_internal_address(void* addr)
+{
+    return find_indexed_slot((uintptr_t)addr, 0);
+}
+
+/**
+ * The slot index is an open addressing table of SLOT_INDEX_ENTRIES entries per slot,
+ * every used slot is in it twice: once by its start and once by its end address.
+ * An entry holds (slot number + 1) << 1 and the kind of the key in the lowest bit, the
+ * key itself is read from the slot. So a slot must be unindexed before its internal
+ * address or size changes, and indexed again afterwards.
+ */
+static void
+slot_list_layout()
+{
+    /* the packed slots, their sizes, the index and their modes, the 4 byte arrays first */
+    slot_count = slot_list_size / SLOT_BYTES;
+    slot_pages = (uint32_t*)&slot_list[slot_count];
+    slot_index = &slot_pages[slot_count];
+    slot_index_capacity = (size_t)slot_count * SLOT_INDEX_ENTRIES;
+    slot_modes = (uint8_t*)&slot_index[slot_index_capacity];
+}
+
+/**
+ * Tell whether memory lies within the UINT32_MAX pages the slots count from heap_base
+ */
+static bool
+slot_in_reach(void* internal_address, size_t internal_size)
+{
+    size_t page_size = PAGE_SIZE;
+    uintptr_t page = ((uintptr_t)internal_address - heap_base) / page_size;
+
+    return (uintptr_t)internal_address >= heap_base && page + internal_size / page_size <= UINT32_MAX;
+}
+
+/**
+ * Create memory for the heap within the reach of the slots
+ *
+ * The system may put the memory anywhere once the address after the last block is
+ * taken. Memory out of reach is given back and asked for again at places spread
+ * around the middle of the reach. The reach is a hard limit: a heap that cannot
+ * get memory within it stops the process.
+ */
+static void*
+fl_create_in_reach(size_t size)
+{
+    size_t page_size = PAGE_SIZE;
+    uintptr_t reach = (uintptr_t)UINT32_MAX * page_size;
+    uintptr_t step = reach / 2 / (SLOT_REACH_RETRIES / 2 + 1);
+    uintptr_t hint;
+    void* chunk = page_create(size);
 
-    for (; count < slot_count; count++)
+    for (int i = 1; !slot_in_reach(chunk, size) && i <= SLOT_REACH_RETRIES; i++)
     {
-        if (addr == get_address(s->internal_address, s->internal_size))
+        page_destroy(chunk, size);
+
+        /* alternately above and below the middle, further away every second try */
+        hint = heap_base + reach / 2;
+        hint = (i & 1) ? hint + (i + 1) / 2 * step : hint - (i + 1) / 2 * step;
+        chunk = page_create_at((void*)(hint & ~(page_size - 1)), size);
+    }
+
+    if (!slot_in_reach(chunk, size))
+    {
+        fl_error("malloc(): no memory within the reach of the slots\n");
+    }
+    return chunk;
+}
+
+/**
+ * Point a slot at memory its owner takes as a whole
+ *
+ * The memory must lie within the reach of the slots, see slot_in_reach().
+ */
+static void
+set_slot(slot* s, void* internal_address, size_t internal_size, mode mode)
+{
+    size_t page_size = PAGE_SIZE;
+    uintptr_t page = ((uintptr_t)internal_address - heap_base) / page_size;
+
+    if (!slot_in_reach(internal_address, internal_size))
+    {
+        fl_error("malloc(): %a is out of the reach of the slots\n", internal_address);
+    }
+
+    s->page = page;
+    s->user_offset = 0;
+    s->user_slack = 0;
+    slot_pages[get_slot_number(s)] = internal_size / page_size;
+    slot_modes[get_slot_number(s)] = mode;
+}
+
+/**
+ * Place the buffer of a slot in its memory
+ */
+static void
+set_slot_user(slot* s, void* user_address, size_t user_size)
+{
+    s->user_offset = (uintptr_t)user_address - (uintptr_t)get_slot_internal_address(s);
+    s->user_slack = get_slot_internal_size(s) - s->user_offset - user_size;
+}
+
+static void
+clear_slot(slot* s)
+{
+    s->page = s->user_offset = s->user_slack = 0;
+    slot_pages[get_slot_number(s)] = 0;
+    slot_modes[get_slot_number(s)] = IOTA_SLOT;
+}
+
+static uintptr_t
+slot_key(slot* s, uint32_t kind)
+{
+    return (uintptr_t)get_slot_internal_address(s) + (kind ? get_slot_internal_size(s) : 0);
+}
+
+static size_t
+slot_index_hash(uintptr_t key)
+{
+    return (size_t)((key * 0x9e3779b97f4a7c15UL) >> 32) % slot_index_capacity;
+}
+
+static uintptr_t
+slot_index_key(uint32_t entry)
+{
+    return slot_key(&slot_list[(entry >> 1) - 1], entry & 1);
+}
+
+static void
+slot_index_insert(uint32_t entry)
+{
+    size_t i = slot_index_hash(slot_index_key(entry));
+
+    while (slot_index[i])
+    {
+        i = (i + 1) % slot_index_capacity;
+    }
+    slot_index[i] = entry;
+}
+
+static void
+slot_index_remove(uint32_t entry)
+{
+    size_t i = slot_index_hash(slot_index_key(entry));
+    size_t j;
+
+    while (slot_index[i] != entry)
+    {
+        if (!slot_index[i])
+        {
+            fl_error("slot index: internal error\n");
+        }
+        i = (i + 1) % slot_index_capacity;
+    }
+
+    /* shift the following entries back so that no probe sequence is cut */
+    for (j = (i + 1) % slot_index_capacity; slot_index[j]; j = (j + 1) % slot_index_capacity)
+    {
+        size_t home = slot_index_hash(slot_index_key(slot_index[j]));
+        if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j))
+        {
+            slot_index[i] = slot_index[j];
+            i = j;
+        }
+    }
+    slot_index[i] = 0;
+}
+
+static void
+index_slot(slot* s)
+{
+    uint32_t entry = (uint32_t)(s - slot_list + 1) << 1;
+
+    slot_index_insert(entry);
+    slot_index_insert(entry | 1);
+}
+
+static void
+unindex_slot(slot* s)
+{
+    uint32_t entry = (uint32_t)(s - slot_list + 1) << 1;
+
+    slot_index_remove(entry);
+    slot_index_remove(entry | 1);
+}
+
+static slot*
+find_indexed_slot(uintptr_t key, uint32_t kind)
+{
+    size_t i = slot_index_hash(key);
+    uint32_t entry;
+
+    while ((entry = slot_index[i]) != 0)
+    {
+        if ((entry & 1) == kind && slot_index_key(entry) == key)
         {
-            return s;
+            return &slot_list[(entry >> 1) - 1];
         }
-        s++;
+        i = (i + 1) % slot_index_capacity;
     }
 
     return NULL;
 }
 
 static slot*
-get_slot_for_internal_address(void* addr)
+get_unused_slot()
 {
-    slot* s = slot_list;
+    static int hint = 0;
     int count = 0;
 
-    for (; count < slot_count; count++)
-    { 
-        if (s->internal_address == addr)
+    /* next fit, the slots before the hint were taken by the previous calls */
+    for (; count < slot_count; count++, hint++)
+    {
+        if (hint >= slot_count)
         {
-            return s;
+            hint = 0;
+        }
+        if (slot_modes[hint] == IOTA_SLOT)
+        {
+            return &slot_list[hint];
         }
-        s++;
     }
 
+    fl_error("malloc(): no empty slots found\n");
     return NULL;
 }
 
-static void
+void*
+fl_internal_alloc(size_t size)
+{
+    size_t page_size = PAGE_SIZE;
+    size_t slack;
+    void* addr = NULL;
+
+    if ((slack = size % page_size) != 0)
+    {
+        size += page_size - slack;
+    }
+
+    heap_lock();
+    if (slot_list == NULL)
+    {
+        fl_init();
+    }
+
+    allow_access_internal();
+    /* internal requests skip the slot check in pages_alloc, so top up the slots here */
+    if (unused_slots <= 8)
+    {
+        fl_allocate_more_slots();
+    }
+
+    is_internal = true;
+    pages_alloc(size, size, CHUNK_ALIGNMENT, &addr, 1);
+    is_internal = false;
+
+    deny_access_internal();
+    heap_unlock();
+    return addr;
+}
+
+void
+fl_internal_free(void* addr)
+{
+    heap_lock();
+    allow_access_internal();
+
+    is_internal = true;
+    fl_release(addr);
+    is_internal = false;
+
+    deny_access_internal();
+    heap_unlock();
+}
+
+void
+fl_internal_free_list(void* first)
+{
+    void* next;
+
+    heap_lock();
+    allow_access_internal();
+
+    /* the link is read before its run is released and protected */
+    is_internal = true;
+    for (; first != NULL; first = next)
+    {
+        next = *(void**)first;
+        fl_release(first);
+    }
+    is_internal = false;
+
+    deny_access_internal();
+    heap_unlock();
+}
+
+#ifndef FL_NO_PROTECT
+void
 allow_access_internal()
 {
     /* if called for internal data structure, we can be sure that access is allowed */
@@ -639,19 +1977,34 @@ allow_access_internal()
     /* allow access to slot list */
     page_allow_access(slot_list, slot_list_size);
     /* allow access to bin allocator */
-    page_allow_access(slot_list[1].internal_address, slot_list[1].internal_size);
+    page_allow_access(get_slot_internal_address(&slot_list[1]), get_slot_internal_size(&slot_list[1]));
 }
 
-static void
+void
 deny_access_internal()
 {
     /* if called for internal data structure, we can be sure that access is allowed */
     if (is_internal) return;
     /* deny access to bin allocator */
-    page_deny_access(slot_list[1].internal_address, slot_list[1].internal_size);
+    page_deny_access(get_slot_internal_address(&slot_list[1]), get_slot_internal_size(&slot_list[1]));
     /* allow access to slot list */
     page_deny_access(slot_list, slot_list_size);
 }
+#endif
+
+static bool
+is_bin_chunk(void* addr)
+{
+    size_t page_size = PAGE_SIZE;
+
+#ifdef FL_NO_PROTECT
+    /* without guard pages every page allocation leads, so only bin chunks are not page aligned */
+    return (uintptr_t)addr % page_size;
+#else
+    /* bin chunks are never page aligned, trailing page allocations carry GUARD_CANARY instead of a bin index */
+    return (uintptr_t)addr % page_size && !check_canary_bytes(get_address(addr, -1*CHUNK_ALIGNMENT), GUARD_CANARY);
+#endif
+}
 
 static bool
 check_canary_bytes(void* addr, uint8_t canary_byte)
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include <lock.h>
+
+/*
+ * The heap is guarded by a single futex lock. A free() that finds the lock taken
+ * by another thread does not wait for it: it queues the address in a ring and
+ * returns, the next thread that takes the lock releases the queued buffers. The
+ * holder never waits for a producer, it stops at the first entry still being
+ * published. When the ring is full free() waits for the lock instead.
+ */
+
+/* 0 when free, 1 when taken, 2 when taken with threads waiting */
+static int lock_state = 0;
+
+/* The thread holding the lock and the levels it holds */
+static uintptr_t lock_owner = 0;
+static int lock_depth = 0;
+
+/* The address of this variable identifies a thread without a system call */
+static __thread char thread_marker __attribute__((tls_model("initial-exec")));
+
+/* The queued frees: producers claim an entry by moving the tail, the lock holder moves the head */
+static void* remote_frees[REMOTE_FREE_ENTRIES];
+static uint64_t remote_head = 0;
+static uint64_t remote_tail = 0;
+
+static void lock_wait();
+static void lock_wake();
+
+void
+heap_lock()
+{
+    uintptr_t self = (uintptr_t)&thread_marker;
+    int state = 0;
+
+    if (__atomic_load_n(&lock_owner, __ATOMIC_RELAXED) == self)
+    {
+        lock_depth++;
+        return;
+    }
+
+    if (!__atomic_compare_exchange_n(&lock_state, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        /* announce a waiter, whoever unlocks from then on wakes one */
+        while (__atomic_exchange_n(&lock_state, 2, __ATOMIC_ACQUIRE) != 0)
+        {
+            lock_wait();
+        }
+    }
+
+    __atomic_store_n(&lock_owner, self, __ATOMIC_RELAXED);
+    lock_depth = 1;
+}
+
+bool
+heap_trylock()
+{
+    uintptr_t self = (uintptr_t)&thread_marker;
+    int state = 0;
+
+    if (__atomic_load_n(&lock_owner, __ATOMIC_RELAXED) == self)
+    {
+        lock_depth++;
+        return true;
+    }
+
+    if (!__atomic_compare_exchange_n(&lock_state, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        return false;
+    }
+
+    __atomic_store_n(&lock_owner, self, __ATOMIC_RELAXED);
+    lock_depth = 1;
+    return true;
+}
+
+void
+heap_unlock()
+{
+    if (--lock_depth > 0)
+    {
+        return;
+    }
+
+    __atomic_store_n(&lock_owner, 0, __ATOMIC_RELAXED);
+    if (__atomic_exchange_n(&lock_state, 0, __ATOMIC_RELEASE) == 2)
+    {
+        lock_wake();
+    }
+}
+
+int
+heap_lock_depth()
+{
+    if (__atomic_load_n(&lock_owner, __ATOMIC_RELAXED) != (uintptr_t)&thread_marker)
+    {
+        return 0;
+    }
+    return lock_depth;
+}
+
+void
+heap_lock_reset()
+{
+    __atomic_store_n(&lock_state, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock_owner, 0, __ATOMIC_RELAXED);
+    lock_depth = 0;
+
+    /* an entry claimed by a thread that is gone would never be published */
+    memset(remote_frees, 0, sizeof(remote_frees));
+    __atomic_store_n(&remote_head, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&remote_tail, 0, __ATOMIC_RELAXED);
+}
+
+bool
+remote_free_push(void* addr)
+{
+    uint64_t tail = __atomic_load_n(&remote_tail, __ATOMIC_RELAXED);
+
+    do
+    {
+        if (tail - __atomic_load_n(&remote_head, __ATOMIC_ACQUIRE) >= REMOTE_FREE_ENTRIES)
+        {
+            return false;
+        }
+    }
+    while (!__atomic_compare_exchange_n(&remote_tail, &tail, tail + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    /* the entry is claimed, publish the address for the drain */
+    __atomic_store_n(&remote_frees[tail % REMOTE_FREE_ENTRIES], addr, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool
+remote_free_pending()
+{
+    return __atomic_load_n(&remote_tail, __ATOMIC_RELAXED) != __atomic_load_n(&remote_head, __ATOMIC_RELAXED);
+}
+
+size_t
+remote_free_take(void** out, size_t n)
+{
+    uint64_t head = __atomic_load_n(&remote_head, __ATOMIC_RELAXED);
+    uint64_t tail = __atomic_load_n(&remote_tail, __ATOMIC_RELAXED);
+    size_t taken = 0;
+
+    for (; head != tail && taken < n; head++)
+    {
+        void** entry = &remote_frees[head % REMOTE_FREE_ENTRIES];
+        void* addr;
+
+        /* a producer claimed the entry without publishing it yet, the next drain takes it and what follows */
+        if ((addr = __atomic_load_n(entry, __ATOMIC_ACQUIRE)) == NULL)
+        {
+            break;
+        }
+
+        *entry = NULL;
+        out[taken++] = addr;
+    }
+
+    /* the entries can be claimed again */
+    __atomic_store_n(&remote_head, head, __ATOMIC_RELEASE);
+    return taken;
+}
+
+static void
+lock_wait()
+{
+    syscall(SYS_futex, &lock_state, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+}
+
+static void
+lock_wake()
+{
+    syscall(SYS_futex, &lock_state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
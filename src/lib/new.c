@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <fl.h>
+#include <page.h>
+#include <print.h>
+
+/*
+ * The C++ allocation functions, so that operator new and delete reach fault-line
+ * directly under LD_PRELOAD instead of going through the malloc() of libstdc++.
+ *
+ * The library is C, so the operators are defined under their Itanium ABI names. The
+ * names encode size_t as unsigned long, which holds on LP64 targets only. Without a
+ * C++ runtime std::bad_alloc cannot be thrown, a failing throwing new is fatal.
+ */
+#if UINTPTR_MAX == 0xffffffffffffffffUL
+
+/* std::align_val_t is an enum of size_t, std::nothrow_t is passed by reference */
+typedef size_t align_val_t;
+
+void* operator_new(size_t size) __asm__("_Znwm");
+void* operator_new_array(size_t size) __asm__("_Znam");
+void* operator_new_nothrow(size_t size, const void* tag) __asm__("_ZnwmRKSt9nothrow_t");
+void* operator_new_array_nothrow(size_t size, const void* tag) __asm__("_ZnamRKSt9nothrow_t");
+void* operator_new_aligned(size_t size, align_val_t alignment) __asm__("_ZnwmSt11align_val_t");
+void* operator_new_array_aligned(size_t size, align_val_t alignment) __asm__("_ZnamSt11align_val_t");
+void* operator_new_aligned_nothrow(size_t size, align_val_t alignment, const void* tag)
+    __asm__("_ZnwmSt11align_val_tRKSt9nothrow_t");
+void* operator_new_array_aligned_nothrow(size_t size, align_val_t alignment, const void* tag)
+    __asm__("_ZnamSt11align_val_tRKSt9nothrow_t");
+
+void operator_delete(void* addr) __asm__("_ZdlPv");
+void operator_delete_array(void* addr) __asm__("_ZdaPv");
+void operator_delete_sized(void* addr, size_t size) __asm__("_ZdlPvm");
+void operator_delete_array_sized(void* addr, size_t size) __asm__("_ZdaPvm");
+void operator_delete_nothrow(void* addr, const void* tag) __asm__("_ZdlPvRKSt9nothrow_t");
+void operator_delete_array_nothrow(void* addr, const void* tag) __asm__("_ZdaPvRKSt9nothrow_t");
+void operator_delete_aligned(void* addr, align_val_t alignment) __asm__("_ZdlPvSt11align_val_t");
+void operator_delete_array_aligned(void* addr, align_val_t alignment) __asm__("_ZdaPvSt11align_val_t");
+void operator_delete_sized_aligned(void* addr, size_t size, align_val_t alignment) __asm__("_ZdlPvmSt11align_val_t");
+void operator_delete_array_sized_aligned(void* addr, size_t size, align_val_t alignment)
+    __asm__("_ZdaPvmSt11align_val_t");
+void operator_delete_aligned_nothrow(void* addr, align_val_t alignment, const void* tag)
+    __asm__("_ZdlPvSt11align_val_tRKSt9nothrow_t");
+void operator_delete_array_aligned_nothrow(void* addr, align_val_t alignment, const void* tag)
+    __asm__("_ZdaPvSt11align_val_tRKSt9nothrow_t");
+
+static void* new_or_die(size_t size, size_t alignment, void* caller);
+
+/* the return address of each operator is passed down, the stack of a sample starts at the caller of new */
+static void*
+new_or_die(size_t size, size_t alignment, void* caller)
+{
+    void* addr = fl_allocate(alignment, size, caller);
+
+    if (addr == NULL)
+    {
+        fl_error("operator new(): unable to allocate %U bytes aligned to %U\n", size, alignment);
+    }
+    return addr;
+}
+
+void* operator_new(size_t size) { return new_or_die(size, CHUNK_ALIGNMENT, __builtin_return_address(0)); }
+void* operator_new_array(size_t size) { return new_or_die(size, CHUNK_ALIGNMENT, __builtin_return_address(0)); }
+
+void*
+operator_new_nothrow(size_t size, const void* tag)
+{
+    return fl_allocate(CHUNK_ALIGNMENT, size, __builtin_return_address(0));
+}
+
+void*
+operator_new_array_nothrow(size_t size, const void* tag)
+{
+    return fl_allocate(CHUNK_ALIGNMENT, size, __builtin_return_address(0));
+}
+
+void*
+operator_new_aligned(size_t size, align_val_t alignment)
+{
+    return new_or_die(size, alignment, __builtin_return_address(0));
+}
+
+void*
+operator_new_array_aligned(size_t size, align_val_t alignment)
+{
+    return new_or_die(size, alignment, __builtin_return_address(0));
+}
+
+void*
+operator_new_aligned_nothrow(size_t size, align_val_t alignment, const void* tag)
+{
+    return fl_allocate(alignment, size, __builtin_return_address(0));
+}
+
+void*
+operator_new_array_aligned_nothrow(size_t size, align_val_t alignment, const void* tag)
+{
+    return fl_allocate(alignment, size, __builtin_return_address(0));
+}
+
+void operator_delete(void* addr) { free(addr); }
+void operator_delete_array(void* addr) { free(addr); }
+void operator_delete_sized(void* addr, size_t size) { fl_free_sized(addr, size, CHUNK_ALIGNMENT); }
+void operator_delete_array_sized(void* addr, size_t size) { fl_free_sized(addr, size, CHUNK_ALIGNMENT); }
+void operator_delete_nothrow(void* addr, const void* tag) { free(addr); }
+void operator_delete_array_nothrow(void* addr, const void* tag) { free(addr); }
+void operator_delete_aligned(void* addr, align_val_t alignment) { free(addr); }
+void operator_delete_array_aligned(void* addr, align_val_t alignment) { free(addr); }
+
+void
+operator_delete_sized_aligned(void* addr, size_t size, align_val_t alignment)
+{
+    fl_free_sized(addr, size, alignment);
+}
+
+void
+operator_delete_array_sized_aligned(void* addr, size_t size, align_val_t alignment)
+{
+    fl_free_sized(addr, size, alignment);
+}
+
+void operator_delete_aligned_nothrow(void* addr, align_val_t alignment, const void* tag) { free(addr); }
+void operator_delete_array_aligned_nothrow(void* addr, align_val_t alignment, const void* tag) { free(addr); }
+
+#endif
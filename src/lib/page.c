@@ -2,13 +2,29 @@
 #include <stdint.h>
 #include <sys/mman.h>
 
+#include <fl.h>
 #include <page.h>
 #include <print.h>
+#include <stats.h>
 
 void* start_address = NULL;
+size_t system_page_size = 0;
+
+size_t
+page_size_query()
+{
+    system_page_size = (size_t)sysconf(_SC_PAGESIZE);
+    return system_page_size;
+}
 
 void*
 page_create(size_t size)
+{
+    return page_create_at(start_address, size);
+}
+
+void*
+page_create_at(void* hint, size_t size)
 {
     void* s = NULL;
 
@@ -16,9 +32,10 @@ page_create(size_t size)
         mmap chooses a page-aligned address (for most operating systems)
         This is similar to extending the heap boundary
     */
-    s = mmap(start_address, size, PROT_READ | PROT_WRITE, 
+    s = mmap(hint, size, PROT_READ | PROT_WRITE, 
                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (s == NULL)
+    if (instrumented(stats)) stats_add(&stats->mmap_calls, 1);
+    if (s == MAP_FAILED)
     {
         fl_error("page_create: unable to create a memory block with mmap\n");
     }
@@ -28,6 +45,19 @@ page_create(size_t size)
     return s;
 }
 
+void
+page_destroy(void* address, size_t size)
+{
+    if (!address) return;
+
+    if (instrumented(stats)) stats_add(&stats->munmap_calls, 1);
+    if (munmap(address, size) == -1)
+    {
+        fl_error("page_destroy: munmap error\n");
+    }
+}
+
+#ifndef FL_NO_PROTECT
 void
 page_allow_access(void* address, size_t size)
 {
@@ -38,6 +68,7 @@ page_allow_access(void* address, size_t size)
         fl_error("page_allow_access: address: %a is not page aligned\n", address);
     }
 
+    if (instrumented(stats)) stats_add(&stats->mprotect_calls, 1);
     if (mprotect(address, size, PROT_READ | PROT_WRITE) == -1)
     {
         fl_error("page_allow_access: mprotect error\n");
@@ -54,8 +85,10 @@ page_deny_access(void* address, size_t size)
         fl_error("page_deny_access: address: %a is not page aligned\n", address);
     }
 
+    if (instrumented(stats)) stats_add(&stats->mprotect_calls, 1);
     if (mprotect(address, size, PROT_NONE) == -1)
     {
         fl_error("page_deny_access: mprotect error\n");
     }
 }
+#endif
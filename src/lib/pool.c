@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <fl.h>
+#include <page.h>
+#include <print.h>
+#include <report.h>
+#include <pool.h>
+
+/**
+ * The header of a slab of a pool, the objects follow it
+ *
+ * A slab is one run of pages taken with fl_internal_alloc(). The first slab of a
+ * pool also holds the pool itself right after its header.
+ */
+typedef struct _pool_slab
+{
+    struct _pool_slab* next;   /**< The next older slab */
+    size_t size;               /**< The size of the slab in bytes */
+} pool_slab;
+
+/**
+ * A pool of objects of one size
+ *
+ * Objects are chunks like those of the bins: a metadata word holding the next free
+ * chunk and the allocated bit, a word naming the pool, POOL_CANARY bytes and the
+ * object. Chunks are cut from the newest slab by moving bump, freed chunks are kept
+ * in a list and handed out again first.
+ */
+struct _fl_pool
+{
+    uint64_t magic;            /**< POOL_MAGIC while the pool is alive */
+    size_t object_size;        /**< The size of an object */
+    size_t alignment;          /**< The alignment of an object */
+    size_t stride;             /**< The bytes between two chunks */
+    size_t slab_size;          /**< The size of each slab */
+    pool_slab* slabs;          /**< The slabs, the newest first */
+    uintptr_t free;            /**< The last freed chunk, 0 if none */
+    uintptr_t bump;            /**< The next chunk of the newest slab that was never handed out */
+    uintptr_t end;             /**< The end of the newest slab */
+    size_t live;               /**< The number of objects taken */
+};
+
+static bool pool_grow(fl_pool* pool);
+static uintptr_t pool_first_chunk(fl_pool* pool, pool_slab* slab);
+static void pool_check(fl_pool* pool, char* caller);
+static size_t round_up(size_t size, size_t alignment);
+
+fl_pool*
+fl_pool_create(size_t object_size, size_t alignment)
+{
+    size_t page_size = PAGE_SIZE;
+    size_t stride;
+    size_t slab_size;
+    pool_slab* slab;
+    fl_pool* pool;
+
+    if (alignment == 0)
+    {
+        alignment = CHUNK_ALIGNMENT;
+    }
+    if ((alignment & (alignment - 1)) || alignment > page_size)
+    {
+        return NULL;
+    }
+    if (alignment < CHUNK_ALIGNMENT)
+    {
+        alignment = CHUNK_ALIGNMENT;
+    }
+
+    /* every chunk starts 2 * CHUNK_ALIGNMENT before an aligned object */
+    stride = round_up(2 * CHUNK_ALIGNMENT + round_up(object_size ? object_size : 1, CHUNK_ALIGNMENT), alignment);
+    slab_size = POOL_SLAB_PAGES * page_size;
+    if (slab_size < sizeof(pool_slab) + sizeof(fl_pool) + alignment + stride)
+    {
+        slab_size = round_up(sizeof(pool_slab) + sizeof(fl_pool) + alignment + stride, page_size);
+    }
+
+    slab = (pool_slab*)fl_internal_alloc(slab_size);
+    if (slab == NULL)
+    {
+        return NULL;
+    }
+    slab->next = NULL;
+    slab->size = slab_size;
+
+    pool = (fl_pool*)get_address(slab, sizeof(pool_slab));
+    memset(pool, 0, sizeof(fl_pool));
+    pool->magic = POOL_MAGIC;
+    pool->object_size = object_size;
+    pool->alignment = alignment;
+    pool->stride = stride;
+    pool->slab_size = slab_size;
+    pool->slabs = slab;
+    pool->bump = pool_first_chunk(pool, slab);
+    pool->end = (uintptr_t)get_address(slab, slab_size);
+
+    return pool;
+}
+
+void*
+fl_pool_alloc(fl_pool* pool)
+{
+    uintptr_t* chunk;
+
+    pool_check(pool, "fl_pool_alloc");
+
+    if (pool->free)
+    {
+        chunk = (uintptr_t*)pool->free;
+        pool->free = get_bin_alloc_next(*chunk);
+    }
+    else
+    {
+        if (pool->bump + pool->stride > pool->end && !pool_grow(pool))
+        {
+            return NULL;
+        }
+
+        /* the owner and the canary bytes are written once, when the chunk is cut */
+        chunk = (uintptr_t*)pool->bump;
+        pool->bump += pool->stride;
+        chunk[1] = (uintptr_t)pool;
+        memset(get_address(chunk, CHUNK_ALIGNMENT), POOL_CANARY, CHUNK_ALIGNMENT);
+    }
+
+    *chunk = 1UL;
+    pool->live++;
+    return get_address(chunk, 2 * CHUNK_ALIGNMENT);
+}
+
+void
+fl_pool_free(fl_pool* pool, void* addr)
+{
+    uintptr_t* chunk;
+    uint8_t* canary;
+
+    if (addr == NULL)
+    {
+        return;
+    }
+
+    chunk = (uintptr_t*)get_address(addr, -2 * CHUNK_ALIGNMENT);
+    canary = (uint8_t*)get_address(addr, -1 * CHUNK_ALIGNMENT);
+
+    pool_check(pool, "fl_pool_free");
+
+    /* an object with an error is left alone, so it is leaked rather than handed out again */
+    if (checked((uintptr_t)addr % pool->alignment || chunk[1] != (uintptr_t)pool))
+    {
+        fl_fault(FAULT_INVALID_FREE, addr, "fl_pool_free(): %a was not taken from this pool\n", addr);
+        return;
+    }
+
+    if (checked(!get_bin_alloc_status(*chunk)))
+    {
+        fl_fault(FAULT_DOUBLE_FREE, addr, "fl_pool_free(): double free of address: %a\n", addr);
+        return;
+    }
+
+    for (size_t i = 0; i < CHUNK_ALIGNMENT; i++)
+    {
+        if (checked(canary[i] != POOL_CANARY))
+        {
+            fl_fault(FAULT_CANARY, addr, "fl_pool_free(): canary bytes of %a are corrupted\n", addr);
+            return;
+        }
+    }
+
+    *chunk = pool->free;
+    pool->free = (uintptr_t)chunk;
+    pool->live--;
+}
+
+void
+fl_pool_destroy(fl_pool* pool)
+{
+    pool_slab* slab;
+    pool_slab* next;
+    uintptr_t end;
+
+    pool_check(pool, "fl_pool_destroy");
+
+    /* every chunk ever cut still carries its canary bytes, taken or not */
+    for (slab = pool->slabs; checked(slab != NULL); slab = slab->next)
+    {
+        end = (slab == pool->slabs) ? pool->bump : (uintptr_t)get_address(slab, slab->size);
+        for (uintptr_t chunk = pool_first_chunk(pool, slab); chunk + pool->stride <= end; chunk += pool->stride)
+        {
+            uint8_t* canary = (uint8_t*)get_address(chunk, CHUNK_ALIGNMENT);
+            for (size_t i = 0; i < CHUNK_ALIGNMENT; i++)
+            {
+                if (canary[i] != POOL_CANARY)
+                {
+                    fl_fault(FAULT_CANARY, get_address(chunk, 2 * CHUNK_ALIGNMENT),
+                             "fl_pool_destroy(): canary bytes of %a are corrupted\n", get_address(chunk, 2 * CHUNK_ALIGNMENT));
+                    break;
+                }
+            }
+        }
+    }
+
+    /* the pool lives in its oldest slab, which goes last */
+    pool->magic = 0;
+    for (slab = pool->slabs; slab; slab = next)
+    {
+        next = slab->next;
+        fl_internal_free(slab);
+    }
+}
+
+static bool
+pool_grow(fl_pool* pool)
+{
+    pool_slab* slab = (pool_slab*)fl_internal_alloc(pool->slab_size);
+
+    if (slab == NULL)
+    {
+        return false;
+    }
+
+    slab->next = pool->slabs;
+    slab->size = pool->slab_size;
+    pool->slabs = slab;
+    pool->bump = pool_first_chunk(pool, slab);
+    pool->end = (uintptr_t)get_address(slab, pool->slab_size);
+    return true;
+}
+
+static uintptr_t
+pool_first_chunk(fl_pool* pool, pool_slab* slab)
+{
+    uintptr_t start = (uintptr_t)get_address(slab, sizeof(pool_slab));
+
+    if (start == (uintptr_t)pool)
+    {
+        start += sizeof(fl_pool);
+    }
+    /* the object of the first chunk is aligned, the stride keeps the others aligned */
+    return round_up(start + 2 * CHUNK_ALIGNMENT, pool->alignment) - 2 * CHUNK_ALIGNMENT;
+}
+
+static void
+pool_check(fl_pool* pool, char* caller)
+{
+    if (pool == NULL || pool->magic != POOL_MAGIC)
+    {
+        fl_error("%s(): %a is not a live pool\n", caller, pool);
+    }
+}
+
+static size_t
+round_up(size_t size, size_t alignment)
+{
+    size_t slack;
+
+    if ((slack = size % alignment) != 0)
+    {
+        size += alignment - slack;
+    }
+    return size;
+}
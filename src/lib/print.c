@@ -40,6 +40,12 @@ print_error(char* format_string, ...)
     va_end(args);
 }
 
+void
+vprint_error(char* format_string, va_list args)
+{
+    vprint(2, format_string, args);
+}
+
 void 
 fl_error(char* format_string, ...)
 {
@@ -213,10 +219,3 @@ handle_print_adress(int stream, void* src)
     }
 }
 
-
-int main() {
-
-    print("adsfg%e\n");
-
-    return 0;
-}
\ No newline at end of file
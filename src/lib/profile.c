@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <page.h>
+#include <print.h>
+#include <profile.h>
+
+profile_data* profile = NULL;
+const profile_data* profile_previous = NULL;
+
+#ifndef FL_NO_CHECKS
+
+static profile_data recorded;
+static profile_data previous;
+
+/* The live counts the peaks are taken from */
+static int64_t live_chunks[STATS_CLASSES];
+static int64_t live_pages = 0;
+
+static const char* profile_file = NULL;
+
+static bool profile_in_range(const profile_data* data);
+
+void
+profile_init()
+{
+    const char* path = getenv(PROFILE_ENV);
+    int fd;
+
+    if (path == NULL || *path == '\0' || profile != NULL)
+    {
+        return;
+    }
+
+    /* a missing, foreign or damaged profile only means a cold start */
+    fd = open(path, O_RDONLY);
+    if (fd != -1)
+    {
+        if (read(fd, &previous, sizeof(previous)) == sizeof(previous) && previous.magic == PROFILE_MAGIC &&
+            previous.version == PROFILE_VERSION && previous.page_size == PAGE_SIZE && profile_in_range(&previous))
+        {
+            profile_previous = &previous;
+        }
+        close(fd);
+    }
+
+    memset(&recorded, 0, sizeof(recorded));
+    profile_file = path;
+    profile = &recorded;
+}
+
+/**
+ * Tell whether a later run can prepare its heap for the peaks of a profile
+ *
+ * The magic tells a profile from other files, not a sound one from a damaged one. The
+ * pool and bin pages reserved for the peaks must fit in half of the physical memory,
+ * no run that fit on the system held more, and no peak may be negative.
+ */
+static bool
+profile_in_range(const profile_data* data)
+{
+    size_t page_size = PAGE_SIZE;
+    int64_t limit = sysconf(_SC_PHYS_PAGES) / 2;
+    int64_t pages = data->peak_pages;
+    int64_t chunks;
+
+    if (pages < 0 || pages > limit || data->peak_slots < 0 || data->peak_slots > limit)
+    {
+        return false;
+    }
+
+    /* the bins as fl_prewarm_pages() counts them, every chunk at least CHUNK_ALIGNMENT bytes */
+    for (int i = 0; i < STATS_CLASSES; i++)
+    {
+        if (data->peak_chunks[i] < 0 || data->peak_chunks[i] > limit * (int64_t)(page_size / CHUNK_ALIGNMENT))
+        {
+            return false;
+        }
+        if (i < BIN_MAX_COUNT && get_bin_size(i) <= page_size - BIN_SLAB_HEADER)
+        {
+            chunks = get_bin_chunks(i, page_size);
+            pages += (data->peak_chunks[i] + chunks - 1) / chunks;
+        }
+    }
+    return pages <= limit;
+}
+
+void
+profile_chunks(int ind, int64_t delta)
+{
+    live_chunks[ind] += delta;
+    if (live_chunks[ind] > recorded.peak_chunks[ind])
+    {
+        recorded.peak_chunks[ind] = live_chunks[ind];
+    }
+}
+
+void
+profile_pages(int64_t delta)
+{
+    live_pages += delta;
+    if (live_pages > recorded.peak_pages)
+    {
+        recorded.peak_pages = live_pages;
+    }
+}
+
+void
+profile_slots(int64_t used)
+{
+    if (used > recorded.peak_slots)
+    {
+        recorded.peak_slots = used;
+    }
+}
+
+__attribute__((destructor)) static void
+profile_fini()
+{
+    int fd;
+
+    if (profile == NULL) return;
+
+    recorded.magic = PROFILE_MAGIC;
+    recorded.version = PROFILE_VERSION;
+    recorded.page_size = PAGE_SIZE;
+
+    /* profiling is best effort, a failure only costs the next run its warm up */
+    fd = open(profile_file, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        print_error("profile_fini: unable to create %s\n", (char*)profile_file);
+        return;
+    }
+    if (write(fd, &recorded, sizeof(recorded)) != sizeof(recorded))
+    {
+        print_error("profile_fini: unable to write %s\n", (char*)profile_file);
+    }
+    close(fd);
+}
+
+#endif // FL_NO_CHECKS
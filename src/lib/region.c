@@ -0,0 +1,243 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <fl.h>
+#include <page.h>
+#include <print.h>
+#include <report.h>
+#include <region.h>
+
+/**
+ * The header of a span, the objects follow it up to the guard page at its end
+ *
+ * The first span of a region also holds the region itself right after its header.
+ * The next span comes first, fl_internal_free_list() follows it.
+ */
+typedef struct _region_span
+{
+    struct _region_span* next; /**< The next span of the region */
+    size_t size;               /**< The size of the span in bytes, the guard page included */
+    uintptr_t top;             /**< The end of the objects, kept up to date once the region leaves the span */
+    uintptr_t bottom;          /**< The first object */
+} region_span;
+
+/**
+ * A region of objects released together
+ *
+ * Objects are cut from the current span, the first one of the list, by moving
+ * bump. In a checked region an object is preceded by its size and canary bytes
+ * and followed by canary bytes, so destroy can walk and check every one of them.
+ */
+struct _fl_region
+{
+    uint64_t magic;            /**< REGION_MAGIC while the region is alive */
+    size_t span_size;          /**< The size of a span, the guard page included */
+    bool canaries;             /**< Whether objects are surrounded by canary bytes */
+    region_span* spans;        /**< The spans, the current one first */
+    uintptr_t bump;            /**< The next free byte of the current span */
+    uintptr_t end;             /**< The guard page of the current span */
+};
+
+static region_span* region_span_create(size_t size);
+static uintptr_t region_first_object(fl_region* region, region_span* span);
+static void region_check(fl_region* region, char* caller);
+static size_t round_up(size_t size, size_t alignment);
+
+fl_region*
+fl_region_create(size_t span_size, bool canaries)
+{
+    size_t page_size = PAGE_SIZE;
+    region_span* span;
+    fl_region* region;
+
+    if (span_size == 0)
+    {
+        span_size = REGION_SPAN_PAGES * page_size;
+    }
+    /* at least a page of objects in front of the guard page */
+    span_size = round_up(span_size, page_size);
+    if (span_size < (1 + GUARD_PAGES) * page_size)
+    {
+        span_size = (1 + GUARD_PAGES) * page_size;
+    }
+
+    span = region_span_create(span_size);
+    if (span == NULL)
+    {
+        return NULL;
+    }
+
+    region = (fl_region*)get_address(span, sizeof(region_span));
+    memset(region, 0, sizeof(fl_region));
+    region->magic = REGION_MAGIC;
+    region->span_size = span_size;
+    region->canaries = checked(canaries);
+    region->spans = span;
+    region->bump = span->bottom = region_first_object(region, span);
+    region->end = (uintptr_t)get_address(span, span_size - GUARD_PAGES * page_size);
+
+    return region;
+}
+
+void*
+fl_region_alloc(fl_region* region, size_t size)
+{
+    size_t page_size = PAGE_SIZE;
+    size_t needed;
+    region_span* span;
+    uintptr_t object;
+
+    region_check(region, "fl_region_alloc");
+
+    needed = round_up(size ? size : 1, CHUNK_ALIGNMENT);
+    if (region->canaries)
+    {
+        needed += 2 * CHUNK_ALIGNMENT;
+    }
+
+    if (region->bump + needed > region->end)
+    {
+        /* too large for a span, it gets one of its own behind the current span */
+        if (sizeof(region_span) + needed > region->span_size - GUARD_PAGES * page_size)
+        {
+            span = region_span_create(round_up(sizeof(region_span) + needed, page_size) + GUARD_PAGES * page_size);
+            if (span == NULL)
+            {
+                return NULL;
+            }
+            /* the object ends against the guard page, an overrun faults at once */
+            span->top = (uintptr_t)get_address(span, span->size - GUARD_PAGES * page_size);
+            object = span->top - needed;
+            span->bottom = object;
+            span->next = region->spans->next;
+            region->spans->next = span;
+            goto found;
+        }
+
+        span = region_span_create(region->span_size);
+        if (span == NULL)
+        {
+            return NULL;
+        }
+        region->spans->top = region->bump;
+        span->next = region->spans;
+        region->spans = span;
+        region->bump = span->bottom = region_first_object(region, span);
+        region->end = (uintptr_t)get_address(span, region->span_size - GUARD_PAGES * page_size);
+    }
+
+    object = region->bump;
+    region->bump += needed;
+
+found:
+    if (!region->canaries)
+    {
+        return (void*)object;
+    }
+
+    /* [size][canary bytes][object][canary bytes] */
+    *(uint64_t*)object = needed;
+    memset(get_address(object, sizeof(uint64_t)), REGION_CANARY, CHUNK_ALIGNMENT - sizeof(uint64_t));
+    memset(get_address(object, needed - CHUNK_ALIGNMENT), REGION_CANARY, CHUNK_ALIGNMENT);
+    return get_address(object, CHUNK_ALIGNMENT);
+}
+
+void
+fl_region_destroy(fl_region* region)
+{
+    region_span* span;
+    uintptr_t object;
+    uintptr_t top;
+    uint8_t* bytes;
+    size_t needed;
+
+    region_check(region, "fl_region_destroy");
+
+    for (span = region->spans; region->canaries && span; span = span->next)
+    {
+        top = (span == region->spans) ? region->bump : span->top;
+        for (object = span->bottom; object < top; object += needed)
+        {
+            bytes = (uint8_t*)object;
+            needed = *(uint64_t*)object;
+
+            /* a size overwritten by an overrun cannot be walked past, the rest of the span is skipped */
+            if (needed < 3 * CHUNK_ALIGNMENT || needed % CHUNK_ALIGNMENT || needed > top - object)
+            {
+                fl_fault(FAULT_CANARY, get_address(object, CHUNK_ALIGNMENT),
+                         "fl_region_destroy(): the header of %a is corrupted\n", get_address(object, CHUNK_ALIGNMENT));
+                break;
+            }
+
+            for (size_t i = 0; i < CHUNK_ALIGNMENT; i++)
+            {
+                if ((i >= sizeof(uint64_t) && bytes[i] != REGION_CANARY) || bytes[needed - CHUNK_ALIGNMENT + i] != REGION_CANARY)
+                {
+                    fl_fault(FAULT_CANARY, get_address(object, CHUNK_ALIGNMENT),
+                             "fl_region_destroy(): canary bytes of %a are corrupted\n", get_address(object, CHUNK_ALIGNMENT));
+                    break;
+                }
+            }
+        }
+    }
+
+    /* the spans go back to the pool in one pass, the region lives in one of them */
+    region->magic = 0;
+    fl_internal_free_list(region->spans);
+}
+
+static region_span*
+region_span_create(size_t size)
+{
+    size_t page_size = PAGE_SIZE;
+    region_span* span = (region_span*)fl_internal_alloc(size);
+
+    if (span == NULL)
+    {
+        return NULL;
+    }
+
+    /* an overrun of the last object faults at once */
+    page_deny_access(get_address(span, size - GUARD_PAGES * page_size), GUARD_PAGES * page_size);
+
+    span->next = NULL;
+    span->size = size;
+    span->top = 0;
+    span->bottom = 0;
+    return span;
+}
+
+static uintptr_t
+region_first_object(fl_region* region, region_span* span)
+{
+    uintptr_t start = (uintptr_t)get_address(span, sizeof(region_span));
+
+    if (start == (uintptr_t)region)
+    {
+        start += round_up(sizeof(fl_region), CHUNK_ALIGNMENT);
+    }
+    return start;
+}
+
+static void
+region_check(fl_region* region, char* caller)
+{
+    if (region == NULL || region->magic != REGION_MAGIC)
+    {
+        fl_error("%s(): %a is not a live region\n", caller, region);
+    }
+}
+
+static size_t
+round_up(size_t size, size_t alignment)
+{
+    size_t slack;
+
+    if ((slack = size % alignment) != 0)
+    {
+        size += alignment - slack;
+    }
+    return size;
+}
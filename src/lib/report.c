@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <print.h>
+#include <report.h>
+
+report_mode report = REPORT_ABORT;
+
+static fault_counters counters;
+
+/* Errors already printed, by kind and address */
+static uint64_t seen[REPORT_SEEN_ENTRIES];
+
+/* The rate limit window, in seconds, and the reports printed in it */
+static int64_t window = 0;
+static uint64_t window_reports = 0;
+static uint64_t window_suppressed = 0;
+
+static bool report_seen(fault_kind kind, void* address);
+
+void
+report_init()
+{
+    const char* env = getenv(REPORT_ENV);
+
+    if (env != NULL && strcmp(env, "continue") == 0)
+    {
+        report = REPORT_CONTINUE;
+    }
+}
+
+void
+fl_fault(fault_kind kind, void* address, char* format_string, ...)
+{
+    va_list args;
+    struct timespec now;
+    uint64_t suppressed;
+
+    __atomic_fetch_add(&counters.count[kind], 1, __ATOMIC_RELAXED);
+
+    if (report == REPORT_ABORT)
+    {
+        va_start(args, format_string);
+        vprint_error(format_string, args);
+        va_end(args);
+        _exit(1);
+    }
+
+    if (report_seen(kind, address))
+    {
+        __atomic_fetch_add(&counters.duplicates, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    /* a coarse clock is plenty for a one second window */
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    if (__atomic_exchange_n(&window, now.tv_sec, __ATOMIC_RELAXED) != now.tv_sec)
+    {
+        __atomic_store_n(&window_reports, 0, __ATOMIC_RELAXED);
+    }
+    if (__atomic_fetch_add(&window_reports, 1, __ATOMIC_RELAXED) >= REPORT_PER_SECOND)
+    {
+        __atomic_fetch_add(&counters.suppressed, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&window_suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    if ((suppressed = __atomic_exchange_n(&window_suppressed, 0, __ATOMIC_RELAXED)) != 0)
+    {
+        print_error("fault-line: %U errors were not reported, over the rate limit\n", suppressed);
+    }
+
+    __atomic_fetch_add(&counters.reported, 1, __ATOMIC_RELAXED);
+    va_start(args, format_string);
+    vprint_error(format_string, args);
+    va_end(args);
+}
+
+void
+fl_fault_counters(fault_counters* out)
+{
+    for (int i = 0; i < NUMBER_OF_FAULT_KINDS; i++)
+    {
+        out->count[i] = __atomic_load_n(&counters.count[i], __ATOMIC_RELAXED);
+    }
+    out->reported = __atomic_load_n(&counters.reported, __ATOMIC_RELAXED);
+    out->duplicates = __atomic_load_n(&counters.duplicates, __ATOMIC_RELAXED);
+    out->suppressed = __atomic_load_n(&counters.suppressed, __ATOMIC_RELAXED);
+}
+
+/**
+ * Remember an error by its kind and address
+ * @return true if it was remembered before
+ */
+static bool
+report_seen(fault_kind kind, void* address)
+{
+    /* the kind goes in the low bits, the key is never 0 */
+    uint64_t key = (((uint64_t)(uintptr_t)address << 3) | kind) + 1;
+    uint64_t hash = key * 0x9e3779b97f4a7c15UL;
+    size_t i = (hash >> 32) % REPORT_SEEN_ENTRIES;
+
+    for (int probe = 0; probe < REPORT_SEEN_PROBES; probe++, i = (i + 1) % REPORT_SEEN_ENTRIES)
+    {
+        uint64_t entry = __atomic_load_n(&seen[i], __ATOMIC_RELAXED);
+        if (entry == key)
+        {
+            return true;
+        }
+        if (entry == 0 && __atomic_compare_exchange_n(&seen[i], &entry, key, false, __ATOMIC_RELAXED,
+                                                      __ATOMIC_RELAXED))
+        {
+            return false;
+        }
+        if (entry == key)
+        {
+            return true;
+        }
+    }
+
+    /* the table is full around this key, report it again rather than never */
+    return false;
+}
@@ -0,0 +1,455 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <execinfo.h>
+
+#include <fl.h>
+#include <page.h>
+#include <print.h>
+#include <stats.h>
+#include <lock.h>
+#include <sample.h>
+
+/**
+ * A live sampled buffer
+ */
+typedef struct _sample_entry
+{
+    uintptr_t address;                /**< The buffer, 0 for an empty entry */
+    uint64_t size;                    /**< The requested size */
+    sample_stack stack;               /**< Where it was allocated */
+} sample_entry;
+
+/**
+ * A buffered writer, profiles are written without stdio
+ */
+typedef struct _sample_writer
+{
+    char buffer[4096];
+    size_t used;
+    int fd;
+} sample_writer;
+
+size_t sample_rate = 0;
+size_t sample_live = 0;
+volatile int sample_dump_requested = 0;
+
+#ifndef FL_NO_CHECKS
+
+/* Open addressing by buffer address, guarded by the heap lock */
+static sample_entry* samples = NULL;
+
+/* Samples ever taken, for the totals of the profile, and samples lost to a full table */
+static uint64_t sampled_count = 0;
+static uint64_t sampled_bytes = 0;
+static uint64_t sample_dropped = 0;
+
+static const char* dump_prefix = NULL;
+static uint64_t dump_sequence = 0;
+
+/* initial-exec keeps the TLS access from calling into the dynamic linker, which may malloc() */
+static __thread int64_t bytes_until_sample __attribute__((tls_model("initial-exec"))) = 0;
+static __thread uint64_t random_state __attribute__((tls_model("initial-exec"))) = 0;
+static __thread bool in_sample __attribute__((tls_model("initial-exec"))) = false;
+
+static int64_t sample_interval();
+static size_t sample_hash(uintptr_t address);
+static void sample_signal(int signal);
+static void write_flush(sample_writer* w);
+static void write_string(sample_writer* w, const char* s);
+static void write_unsigned(sample_writer* w, uint64_t value, int width);
+static void write_hex(sample_writer* w, uintptr_t value);
+
+void
+sample_init()
+{
+    const char* rate = getenv(SAMPLE_RATE_ENV);
+    size_t size = SAMPLE_ENTRIES * sizeof(sample_entry);
+    size_t page_size = PAGE_SIZE;
+    size_t slack;
+    struct sigaction action;
+
+    if (samples != NULL)
+    {
+        return;
+    }
+
+    /* sampling is opt in, a profile prefix alone samples at the default rate */
+    dump_prefix = getenv(SAMPLE_DUMP_ENV);
+    if (rate != NULL)
+    {
+        sample_rate = strtoull(rate, NULL, 10);
+    }
+    else if (dump_prefix != NULL && *dump_prefix != '\0')
+    {
+        sample_rate = SAMPLE_DEFAULT_RATE;
+    }
+    if (sample_rate == 0)
+    {
+        return;
+    }
+
+    /* the table is only touched where samples land, most of it is never backed */
+    if ((slack = size % page_size) != 0)
+    {
+        size += page_size - slack;
+    }
+    samples = page_create(size);
+
+    if (dump_prefix != NULL && *dump_prefix != '\0')
+    {
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = sample_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGUSR2, &action, NULL) == -1)
+        {
+            print_error("sample_init: unable to install the SIGUSR2 handler\n");
+        }
+    }
+}
+
+bool
+sample_take(size_t size, void* caller, sample_stack* stack)
+{
+    int depth;
+    int skip;
+
+    /* unwinding may allocate, those allocations are not sampled */
+    if (in_sample)
+    {
+        return false;
+    }
+
+    if (random_state == 0)
+    {
+        random_state = ((uintptr_t)&random_state ^ stats_clock()) | 1;
+        bytes_until_sample = sample_interval();
+    }
+
+    bytes_until_sample -= size;
+    if (bytes_until_sample > 0)
+    {
+        return false;
+    }
+
+    /* a buffer larger than the interval may cover several, it is still a single sample */
+    do
+    {
+        bytes_until_sample += sample_interval();
+    }
+    while (bytes_until_sample <= 0);
+
+    in_sample = true;
+    depth = backtrace(stack->frames, SAMPLE_MAX_FRAMES);
+    in_sample = false;
+
+    /* the entry points differ in depth and may be inlined, the stack starts at the return address of the one taken */
+    for (skip = 1; skip < depth && stack->frames[skip] != caller; skip++)
+    {
+    }
+    if (skip == depth)
+    {
+        return false;
+    }
+    memmove(stack->frames, stack->frames + skip, (depth - skip) * sizeof(void*));
+    stack->depth = depth - skip;
+    return true;
+}
+
+void
+sample_record(void* addr, size_t size, const sample_stack* stack)
+{
+    size_t at = sample_hash((uintptr_t)addr);
+
+    sampled_count++;
+    sampled_bytes += size;
+
+    /* keep the table sparse enough for short probes */
+    if (sample_live >= SAMPLE_ENTRIES / 4 * 3)
+    {
+        sample_dropped++;
+        return;
+    }
+
+    while (samples[at].address != 0)
+    {
+        at = (at + 1) & (SAMPLE_ENTRIES - 1);
+    }
+    samples[at].address = (uintptr_t)addr;
+    samples[at].size = size;
+    samples[at].stack = *stack;
+    sample_live++;
+}
+
+void
+sample_forget(void* addr)
+{
+    size_t at = sample_hash((uintptr_t)addr);
+    size_t next;
+
+    for (; samples[at].address != (uintptr_t)addr; at = (at + 1) & (SAMPLE_ENTRIES - 1))
+    {
+        if (samples[at].address == 0)
+        {
+            return;
+        }
+    }
+
+    /* backward shift deletion, entries after the hole move up unless they sit at their home */
+    for (next = (at + 1) & (SAMPLE_ENTRIES - 1); samples[next].address != 0; next = (next + 1) & (SAMPLE_ENTRIES - 1))
+    {
+        size_t home = sample_hash(samples[next].address);
+        if (((next - home) & (SAMPLE_ENTRIES - 1)) >= ((next - at) & (SAMPLE_ENTRIES - 1)))
+        {
+            samples[at] = samples[next];
+            at = next;
+        }
+    }
+    samples[at].address = 0;
+    sample_live--;
+}
+
+void
+sample_dump_signaled()
+{
+    char path[4096];
+    size_t length = strlen(dump_prefix);
+    char digits[20];
+    uint64_t values[2] = { getpid(), ++dump_sequence };
+    int i;
+
+    sample_dump_requested = 0;
+
+    /* <prefix>.<pid>.<sequence>.heap */
+    if (length + 2 * sizeof(digits) + 8 > sizeof(path))
+    {
+        print_error("sample_dump_signaled: the %s prefix is too long\n", (char*)SAMPLE_DUMP_ENV);
+        return;
+    }
+    memcpy(path, dump_prefix, length);
+    for (int v = 0; v < 2; v++)
+    {
+        uint64_t value = values[v];
+        path[length++] = '.';
+        i = 0;
+        do
+        {
+            digits[i++] = '0' + value % 10;
+            value /= 10;
+        }
+        while (value > 0);
+        while (i--)
+        {
+            path[length++] = digits[i];
+        }
+    }
+    memcpy(path + length, ".heap", sizeof(".heap"));
+
+    if (fl_heap_profile_dump(path) == -1)
+    {
+        print_error("sample_dump_signaled: unable to write %s\n", path);
+    }
+}
+
+int
+fl_heap_profile_dump(const char* path)
+{
+    sample_writer w;
+    uint64_t live_bytes = 0;
+    ssize_t length;
+    int maps;
+
+    w.used = 0;
+    w.fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (w.fd == -1)
+    {
+        return -1;
+    }
+
+    heap_lock();
+
+    for (size_t i = 0; samples && i < SAMPLE_ENTRIES; i++)
+    {
+        if (samples[i].address != 0)
+        {
+            live_bytes += samples[i].size;
+        }
+    }
+
+    /* heap profile: <in use objects>: <in use bytes> [<allocated objects>: <allocated bytes>] @ heap_v2/<rate> */
+    write_string(&w, "heap profile: ");
+    write_unsigned(&w, sample_live, 6);
+    write_string(&w, ": ");
+    write_unsigned(&w, live_bytes, 8);
+    write_string(&w, " [");
+    write_unsigned(&w, sampled_count, 6);
+    write_string(&w, ": ");
+    write_unsigned(&w, sampled_bytes, 8);
+    write_string(&w, "] @ heap_v2/");
+    write_unsigned(&w, sample_rate, 0);
+    write_string(&w, "\n");
+
+    /* pprof scales each sample back up by its size and the rate */
+    for (size_t i = 0; samples && i < SAMPLE_ENTRIES; i++)
+    {
+        if (samples[i].address == 0)
+        {
+            continue;
+        }
+        write_unsigned(&w, 1, 6);
+        write_string(&w, ": ");
+        write_unsigned(&w, samples[i].size, 8);
+        write_string(&w, " [");
+        write_unsigned(&w, 1, 6);
+        write_string(&w, ": ");
+        write_unsigned(&w, samples[i].size, 8);
+        write_string(&w, "] @");
+        for (int f = 0; f < samples[i].stack.depth; f++)
+        {
+            write_string(&w, " ");
+            write_hex(&w, (uintptr_t)samples[i].stack.frames[f]);
+        }
+        write_string(&w, "\n");
+    }
+
+    if (sample_dropped)
+    {
+        print_error("fl_heap_profile_dump: %U samples were left out, more than %d were live\n",
+                    sample_dropped, SAMPLE_ENTRIES / 4 * 3);
+    }
+
+    heap_unlock();
+
+    /* the mappings let pprof symbolize the addresses */
+    write_string(&w, "\nMAPPED_LIBRARIES:\n");
+    write_flush(&w);
+    maps = open("/proc/self/maps", O_RDONLY);
+    if (maps != -1)
+    {
+        while ((length = read(maps, w.buffer, sizeof(w.buffer))) > 0)
+        {
+            w.used = length;
+            write_flush(&w);
+        }
+        close(maps);
+    }
+
+    close(w.fd);
+    return 0;
+}
+
+static int64_t
+sample_interval()
+{
+    double uniform;
+
+    /* xorshift64, the 53 high bits make a uniform number in (0, 1] */
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    uniform = ((random_state >> 11) + 1) * (1.0 / (1UL << 53));
+
+    /* the gaps between samples of a Poisson process are exponentially distributed */
+    return (int64_t)(-log(uniform) * sample_rate) + 1;
+}
+
+static size_t
+sample_hash(uintptr_t address)
+{
+    address ^= address >> 33;
+    address *= 0xff51afd7ed558ccdUL;
+    address ^= address >> 33;
+    return address & (SAMPLE_ENTRIES - 1);
+}
+
+static void
+sample_signal(int signal)
+{
+    (void)signal;
+    /* the heap may be locked by the interrupted thread, dump from the next allocation */
+    sample_dump_requested = 1;
+}
+
+static void
+write_flush(sample_writer* w)
+{
+    size_t written = 0;
+    ssize_t n;
+
+    while (written < w->used && (n = write(w->fd, w->buffer + written, w->used - written)) > 0)
+    {
+        written += n;
+    }
+    w->used = 0;
+}
+
+static void
+write_string(sample_writer* w, const char* s)
+{
+    for (; *s; s++)
+    {
+        if (w->used == sizeof(w->buffer))
+        {
+            write_flush(w);
+        }
+        w->buffer[w->used++] = *s;
+    }
+}
+
+static void
+write_unsigned(sample_writer* w, uint64_t value, int width)
+{
+    char digits[24];
+    int i = sizeof(digits) - 1;
+
+    digits[i] = '\0';
+    do
+    {
+        digits[--i] = '0' + value % 10;
+        value /= 10;
+    }
+    while (value > 0);
+
+    /* right aligned like the printf widths of gperftools */
+    while ((int)sizeof(digits) - 1 - i < width)
+    {
+        digits[--i] = ' ';
+    }
+    write_string(w, &digits[i]);
+}
+
+static void
+write_hex(sample_writer* w, uintptr_t value)
+{
+    const char hex_digits[] = "0123456789abcdef";
+    char digits[2 + 2 * sizeof(uintptr_t) + 1];
+    int i = sizeof(digits) - 1;
+
+    digits[i] = '\0';
+    do
+    {
+        digits[--i] = hex_digits[value & 0xF];
+        value >>= 4;
+    }
+    while (value > 0);
+    digits[--i] = 'x';
+    digits[--i] = '0';
+    write_string(w, &digits[i]);
+}
+
+#else
+
+int
+fl_heap_profile_dump(const char* path)
+{
+    /* builds without checks never sample, there is no profile to write */
+    (void)path;
+    return -1;
+}
+
+#endif // FL_NO_CHECKS
@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <page.h>
+#include <print.h>
+#include <stats.h>
+
+stats_segment* stats = NULL;
+
+#ifndef FL_NO_CHECKS
+
+/* The file backing the segment, removed when the process that created it exits */
+static char stats_file[STATS_PATH_LENGTH];
+
+static void stats_path_for(char* path, int pid);
+static size_t stats_segment_size();
+static void stats_fork_child();
+
+static void
+stats_path_for(char* path, int pid)
+{
+    char digits[12];
+    size_t length = strlen(STATS_PATH_PREFIX);
+    int i = 0;
+
+    memcpy(path, STATS_PATH_PREFIX, length);
+    do {
+        digits[i++] = '0' + (pid % 10);
+        pid /= 10;
+    }
+    while (pid > 0);
+
+    while (i--)
+    {
+        path[length++] = digits[i];
+    }
+    path[length] = '\0';
+}
+
+static size_t
+stats_segment_size()
+{
+    size_t page_size = PAGE_SIZE;
+    size_t size = sizeof(stats_segment);
+    size_t slack;
+
+    if ((slack = size % page_size) != 0)
+    {
+        size += page_size - slack;
+    }
+    return size;
+}
+
+void
+stats_init()
+{
+    const char* env = getenv(STATS_ENV);
+    size_t page_size = PAGE_SIZE;
+    size_t size = stats_segment_size();
+    stats_segment* segment = NULL;
+    int fd;
+
+    if (env == NULL || *env == '\0' || stats != NULL)
+    {
+        return;
+    }
+
+    /* stats are best effort, never stop the process because of them */
+    stats_path_for(stats_file, getpid());
+    fd = open(stats_file, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        print_error("stats_init: unable to create %s\n", stats_file);
+        return;
+    }
+
+    if (ftruncate(fd, size) == -1)
+    {
+        print_error("stats_init: unable to size %s\n", stats_file);
+        close(fd);
+        unlink(stats_file);
+        return;
+    }
+
+    segment = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED)
+    {
+        print_error("stats_init: unable to map %s\n", stats_file);
+        unlink(stats_file);
+        return;
+    }
+
+    memset(segment, 0, size);
+    segment->version = STATS_VERSION;
+    segment->pid = getpid();
+    segment->page_size = page_size;
+    /* readers wait for the magic before trusting anything else */
+    __atomic_store_n(&segment->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+
+    stats = segment;
+}
+
+/* registered when the library is loaded, not from stats_init(): registering may allocate */
+__attribute__((constructor)) static void
+stats_register_fork()
+{
+    pthread_atfork(NULL, NULL, stats_fork_child);
+}
+
+static void
+stats_fork_child()
+{
+    stats_segment* parent = stats;
+
+    if (parent == NULL) return;
+
+    /* the mapping is still the parent's, the child publishes in a segment of its own */
+    stats = NULL;
+    stats_init();
+    if (stats != NULL)
+    {
+        /* the heap of the child starts as a copy of the parent's, and so do its live bytes */
+        for (int i = 0; i < STATS_CLASSES; i++)
+        {
+            stats->live_bytes[i] = __atomic_load_n(&parent->live_bytes[i], __ATOMIC_RELAXED);
+        }
+    }
+    munmap(parent, stats_segment_size());
+}
+
+__attribute__((destructor)) static void
+stats_fini()
+{
+    /* a child that could not create its own segment must not remove its parent's */
+    if (stats == NULL || getpid() != stats->pid) return;
+    unlink(stats_file);
+}
+
+#endif // FL_NO_CHECKS
@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <fl.h>
+#include <page.h>
+#include <print.h>
+#include <stats.h>
+#include <lock.h>
+#include <trace.h>
+
+/**
+ * The buffer of records of one thread
+ *
+ * Rings are created with page_create() and never freed. A ring whose thread exited
+ * is flushed and handed to the next thread that starts tracing.
+ */
+typedef struct _trace_ring
+{
+    trace_record records[TRACE_RING_RECORDS];  /**< The buffered records */
+    uint32_t count;                            /**< The number of buffered records */
+    uint32_t thread;                           /**< The owner thread, 0 while the ring is unclaimed */
+    uint32_t busy;                             /**< Set while the ring is written or flushed by its thread */
+    struct _trace_ring* next;                  /**< The next ring of the registry */
+} trace_ring;
+
+trace_header* trace = NULL;
+
+#ifndef FL_NO_CHECKS
+
+static trace_record* trace_records = NULL;
+static int trace_fd = -1;
+
+/* Set by trace_fini(), no thread writes to its ring or to the file from then on */
+static uint32_t trace_stopped = 0;
+
+/* Every ring ever created, so that the rings of all threads are flushed at exit */
+static trace_ring* rings = NULL;
+static pthread_key_t ring_key;
+
+/* initial-exec keeps the TLS access from calling into the dynamic linker, which may malloc() */
+static __thread trace_ring* thread_ring __attribute__((tls_model("initial-exec"))) = NULL;
+
+static trace_ring* trace_claim_ring();
+static bool trace_enter(trace_ring* ring);
+static void trace_leave(trace_ring* ring);
+static void trace_flush(trace_ring* ring);
+static void trace_thread_exit(void* ring);
+
+void
+trace_init()
+{
+    const char* path = getenv(TRACE_ENV);
+    const char* records = getenv(TRACE_RECORDS_ENV);
+    size_t capacity = TRACE_DEFAULT_RECORDS;
+    size_t size;
+    trace_header* header;
+
+    if (path == NULL || *path == '\0' || trace != NULL)
+    {
+        return;
+    }
+
+    if (records != NULL && strtoull(records, NULL, 10) > 0)
+    {
+        capacity = strtoull(records, NULL, 10);
+    }
+    size = sizeof(trace_header) + capacity * sizeof(trace_record);
+
+    /* tracing is best effort, never stop the process because of it */
+    trace_fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (trace_fd == -1)
+    {
+        print_error("trace_init: unable to create %s\n", (char*)path);
+        return;
+    }
+
+    if (ftruncate(trace_fd, size) == -1)
+    {
+        print_error("trace_init: unable to size %s\n", (char*)path);
+        close(trace_fd);
+        return;
+    }
+
+    header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, trace_fd, 0);
+    if (header == MAP_FAILED)
+    {
+        print_error("trace_init: unable to map %s\n", (char*)path);
+        close(trace_fd);
+        return;
+    }
+
+    if (pthread_key_create(&ring_key, trace_thread_exit) != 0)
+    {
+        print_error("trace_init: unable to create the thread key\n");
+        munmap(header, size);
+        close(trace_fd);
+        return;
+    }
+
+    header->magic = TRACE_MAGIC;
+    header->version = TRACE_VERSION;
+    header->record_size = sizeof(trace_record);
+    header->capacity = capacity;
+
+    trace_records = (trace_record*)get_address(header, sizeof(trace_header));
+    trace = header;
+}
+
+void
+trace_append(trace_op op, void* address, size_t size)
+{
+    trace_ring* ring = thread_ring;
+    trace_record* record;
+
+    if (ring == NULL)
+    {
+        ring = trace_claim_ring();
+    }
+
+    if (!trace_enter(ring))
+    {
+        return;
+    }
+
+    record = &ring->records[ring->count];
+    record->timestamp = stats_clock();
+    record->address = (uintptr_t)address;
+    record->size = size;
+    record->thread = ring->thread;
+    record->op = op;
+
+    if (++ring->count == TRACE_RING_RECORDS)
+    {
+        trace_flush(ring);
+    }
+
+    trace_leave(ring);
+}
+
+/**
+ * Mark the ring of the calling thread busy, unless recording has stopped
+ *
+ * Either the thread sees trace_stopped, or trace_fini() sees the ring busy and waits.
+ */
+static bool
+trace_enter(trace_ring* ring)
+{
+    __atomic_store_n(&ring->busy, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&trace_stopped, __ATOMIC_SEQ_CST))
+    {
+        __atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+        return false;
+    }
+    return true;
+}
+
+static void
+trace_leave(trace_ring* ring)
+{
+    __atomic_store_n(&ring->busy, 0, __ATOMIC_RELEASE);
+}
+
+static trace_ring*
+trace_claim_ring()
+{
+    uint32_t thread = syscall(SYS_gettid);
+    size_t page_size = PAGE_SIZE;
+    size_t size = sizeof(trace_ring);
+    size_t slack;
+    trace_ring* ring;
+
+    /* reuse the ring of a thread that exited */
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        uint32_t unclaimed = 0;
+        if (__atomic_compare_exchange_n(&ring->thread, &unclaimed, thread, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+    }
+
+    if (ring == NULL)
+    {
+        if ((slack = size % page_size) != 0)
+        {
+            size += page_size - slack;
+        }
+        /* page_create() moves the hint of the heap, which the lock guards */
+        heap_lock();
+        ring = page_create(size);
+        heap_unlock();
+        ring->thread = thread;
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    thread_ring = ring;
+    /* the key only serves its destructor, which flushes the ring when the thread exits */
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+static void
+trace_flush(trace_ring* ring)
+{
+    uint64_t count = ring->count;
+    uint64_t first;
+    uint64_t fit = 0;
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    /* claim a range of the file, flushes of several threads never overlap */
+    first = __atomic_fetch_add(&trace->written, count, __ATOMIC_RELAXED);
+    if (first < trace->capacity)
+    {
+        fit = trace->capacity - first;
+        if (fit > count)
+        {
+            fit = count;
+        }
+        memcpy(&trace_records[first], ring->records, fit * sizeof(trace_record));
+    }
+    if (fit < count)
+    {
+        __atomic_fetch_add(&trace->dropped, count - fit, __ATOMIC_RELAXED);
+    }
+
+    ring->count = 0;
+}
+
+static void
+trace_thread_exit(void* arg)
+{
+    trace_ring* ring = (trace_ring*)arg;
+
+    /* once recording has stopped the ring is trace_fini()'s to flush */
+    if (trace_enter(ring))
+    {
+        trace_flush(ring);
+        trace_leave(ring);
+    }
+    thread_ring = NULL;
+    __atomic_store_n(&ring->thread, 0, __ATOMIC_RELEASE);
+}
+
+__attribute__((destructor)) static void
+trace_fini()
+{
+    trace_ring* ring;
+    uint64_t records;
+
+    if (trace == NULL) return;
+
+    /* later operations, like those of other destructors and threads still running, are not recorded */
+    __atomic_store_n(&trace_stopped, 1, __ATOMIC_SEQ_CST);
+
+    /* a ring is flushed once its thread is done with it, nothing writes to the file afterwards */
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        while (__atomic_load_n(&ring->busy, __ATOMIC_ACQUIRE))
+        {
+            sched_yield();
+        }
+        trace_flush(ring);
+    }
+    records = trace->written < trace->capacity ? trace->written : trace->capacity;
+
+    /* cut the unused tail of the file */
+    if (ftruncate(trace_fd, sizeof(trace_header) + records * sizeof(trace_record)) == -1)
+    {
+        print_error("trace_fini: unable to truncate the trace file\n");
+    }
+}
+
+#endif // FL_NO_CHECKS
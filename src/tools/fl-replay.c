@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <trace.h>
+
+/*
+ * fl-replay runs the malloc()/free() calls of a trace recorded with FL_TRACE against
+ * the allocator of the process: the system allocator by default, or the library
+ * given with -l, which is preloaded by re-executing the tool. Records of all threads
+ * are replayed on a single thread in timestamp order.
+ *
+ * The tool keeps its own tables in mmap'd memory so that they do not show up in
+ * the numbers of the allocator under test.
+ */
+
+#define RSS_SAMPLE_OPS 4096    // Operations between two samples of the resident set
+
+/**
+ * An operation of the replay, the address of the trace is replaced by a dense id
+ */
+typedef struct _replay_op
+{
+    uint32_t op;               /**< The trace_op */
+    uint32_t id;               /**< The index of the allocation */
+} replay_op;
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: fl-replay [-l library] trace\n");
+    fprintf(stderr, "  -l library  preload this allocator, like ./libfl.so, instead of the system one\n");
+    exit(2);
+}
+
+static void*
+table_create(size_t size)
+{
+    void* table = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (table == MAP_FAILED)
+    {
+        fprintf(stderr, "fl-replay: out of memory for %zu bytes of tables\n", size);
+        exit(1);
+    }
+    return table;
+}
+
+static int
+compare_records(const void* a, const void* b)
+{
+    const trace_record* ra = (const trace_record*)a;
+    const trace_record* rb = (const trace_record*)b;
+
+    return (ra->timestamp > rb->timestamp) - (ra->timestamp < rb->timestamp);
+}
+
+static size_t
+resident_bytes(int statm)
+{
+    char buffer[128];
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    ssize_t length = pread(statm, buffer, sizeof(buffer) - 1, 0);
+
+    if (length <= 0)
+    {
+        return 0;
+    }
+    buffer[length] = '\0';
+    sscanf(buffer, "%lu %lu", &size, &resident);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static uint64_t
+hash_address(uint64_t address)
+{
+    address ^= address >> 33;
+    address *= 0xff51afd7ed558ccdUL;
+    address ^= address >> 33;
+    return address;
+}
+
+/**
+ * Translate the records into replay operations with dense ids
+ * @return The number of operations written to ops
+ */
+static size_t
+translate(const trace_record* records, size_t count, replay_op* ops, uint64_t* sizes, size_t* unmatched)
+{
+    size_t capacity = 1;
+    uint64_t* keys;
+    uint32_t* ids;
+    size_t used = 0;
+    uint32_t next_id = 0;
+
+    while (capacity < 2 * count)
+    {
+        capacity <<= 1;
+    }
+    keys = table_create(capacity * sizeof(uint64_t));
+    ids = table_create(capacity * sizeof(uint32_t));
+
+    /* open addressing, a key of 1 marks a removed entry (no allocation is at address 1) */
+    for (size_t i = 0; i < count; i++)
+    {
+        const trace_record* r = &records[i];
+        size_t at = hash_address(r->address) & (capacity - 1);
+
+        if (r->address == 0)
+        {
+            continue;
+        }
+
+        if (r->op == TRACE_MALLOC)
+        {
+            size_t free_at = capacity;
+            for (; keys[at] != 0; at = (at + 1) & (capacity - 1))
+            {
+                if (keys[at] == r->address)
+                {
+                    /* the address was handed out again without a recorded free */
+                    free_at = at;
+                    break;
+                }
+                if (keys[at] == 1 && free_at == capacity)
+                {
+                    free_at = at;
+                }
+            }
+            if (free_at == capacity)
+            {
+                free_at = at;
+            }
+            keys[free_at] = r->address;
+            ids[free_at] = next_id;
+            sizes[next_id] = r->size;
+            ops[used].op = TRACE_MALLOC;
+            ops[used].id = next_id++;
+            used++;
+        }
+        else if (r->op == TRACE_FREE)
+        {
+            for (; keys[at] != 0 && keys[at] != r->address; at = (at + 1) & (capacity - 1));
+            if (keys[at] == 0)
+            {
+                /* allocated before the trace started */
+                (*unmatched)++;
+                continue;
+            }
+            keys[at] = 1;
+            ops[used].op = TRACE_FREE;
+            ops[used].id = ids[at];
+            used++;
+        }
+    }
+
+    munmap(keys, capacity * sizeof(uint64_t));
+    munmap(ids, capacity * sizeof(uint32_t));
+    return used;
+}
+
+static void
+preload(const char* library, char** argv, int optind)
+{
+    char* args[3];
+
+    if (setenv("LD_PRELOAD", library, 1) == -1)
+    {
+        fprintf(stderr, "fl-replay: cannot set LD_PRELOAD: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    args[0] = argv[0];
+    args[1] = argv[optind];
+    args[2] = NULL;
+    execv("/proc/self/exe", args);
+    fprintf(stderr, "fl-replay: cannot re-execute with %s: %s\n", library, strerror(errno));
+    exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+    const char* library = NULL;
+    const trace_header* header;
+    trace_record* records;
+    replay_op* ops;
+    uint64_t* sizes;
+    void** live;
+    struct stat st;
+    struct timespec begin;
+    struct timespec end;
+    size_t count;
+    size_t nops;
+    size_t unmatched = 0;
+    size_t mallocs = 0;
+    size_t baseline;
+    size_t peak_rss = 0;
+    size_t live_bytes = 0;
+    size_t peak_live = 0;
+    double seconds;
+    bool is_fl;
+    int opt;
+    int fd;
+    int statm;
+
+    while ((opt = getopt(argc, argv, "l:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l':
+                library = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind + 1 != argc)
+    {
+        usage();
+    }
+
+    /* never record the replay itself over the trace being replayed */
+    unsetenv(TRACE_ENV);
+    if (library != NULL)
+    {
+        preload(library, argv, optind);
+    }
+
+    fd = open(argv[optind], O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(trace_header))
+    {
+        fprintf(stderr, "fl-replay: cannot read %s\n", argv[optind]);
+        return 1;
+    }
+    header = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED || header->magic != TRACE_MAGIC || header->version != TRACE_VERSION ||
+        header->record_size != sizeof(trace_record))
+    {
+        fprintf(stderr, "fl-replay: %s is not a trace of this version\n", argv[optind]);
+        return 1;
+    }
+
+    count = header->written < header->capacity ? header->written : header->capacity;
+    if (count > (st.st_size - sizeof(trace_header)) / sizeof(trace_record))
+    {
+        count = (st.st_size - sizeof(trace_header)) / sizeof(trace_record);
+    }
+    if (header->dropped)
+    {
+        fprintf(stderr, "fl-replay: warning: %lu records were dropped while tracing\n", header->dropped);
+    }
+
+    /* flushes of different threads interleave in the file */
+    records = table_create(count * sizeof(trace_record));
+    memcpy(records, (const char*)header + sizeof(trace_header), count * sizeof(trace_record));
+    munmap((void*)header, st.st_size);
+    qsort(records, count, sizeof(trace_record), compare_records);
+
+    ops = table_create(count * sizeof(replay_op));
+    sizes = table_create(count * sizeof(uint64_t));
+    nops = translate(records, count, ops, sizes, &unmatched);
+    munmap(records, count * sizeof(trace_record));
+    live = table_create(count * sizeof(void*));
+
+    is_fl = dlsym(RTLD_DEFAULT, "fl_check_heap") != NULL;
+    statm = open("/proc/self/statm", O_RDONLY);
+    baseline = resident_bytes(statm);
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (size_t i = 0; i < nops; i++)
+    {
+        replay_op* op = &ops[i];
+
+        if (op->op == TRACE_MALLOC)
+        {
+            live[op->id] = malloc(sizes[op->id]);
+            if (live[op->id] && sizes[op->id])
+            {
+                /* the application writes what it allocates */
+                *(volatile char*)live[op->id] = 1;
+            }
+            live_bytes += sizes[op->id];
+            if (live_bytes > peak_live)
+            {
+                peak_live = live_bytes;
+            }
+            mallocs++;
+        }
+        else
+        {
+            free(live[op->id]);
+            live[op->id] = NULL;
+            live_bytes -= sizes[op->id];
+        }
+
+        if (i % RSS_SAMPLE_OPS == 0)
+        {
+            size_t rss = resident_bytes(statm);
+            if (rss > peak_rss)
+            {
+                peak_rss = rss;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (resident_bytes(statm) > peak_rss)
+    {
+        peak_rss = resident_bytes(statm);
+    }
+    peak_rss = peak_rss > baseline ? peak_rss - baseline : 0;
+    seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+
+    printf("allocator      %s\n", is_fl ? "libfl" : "system");
+    printf("operations     %zu (%zu malloc, %zu free, %zu unmatched free skipped)\n",
+           nops, mallocs, nops - mallocs, unmatched);
+    printf("time           %.6f s\n", seconds);
+    printf("throughput     %.0f ops/s\n", seconds > 0 ? nops / seconds : 0);
+    printf("peak live      %zu bytes\n", peak_live);
+    printf("peak rss       %zu bytes above the %zu bytes before the replay\n", peak_rss, baseline);
+    printf("fragmentation  %.1f%%\n", peak_rss > peak_live ? 100.0 * (1.0 - (double)peak_live / peak_rss) : 0.0);
+
+    return 0;
+}
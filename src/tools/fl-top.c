@@ -0,0 +1,294 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <fl.h>
+#include <stats.h>
+
+/*
+ * fl-top attaches read-only to the stats segment published by a process running
+ * with FL_STATS=1 and refreshes the numbers every interval. It never writes to the
+ * segment, so it cannot disturb the allocator it watches.
+ */
+
+#define TOP_CLASSES 16    // Size classes shown, the ones holding the most live bytes
+
+static const char* path_names[NUMBER_OF_STATS_PATHS] = {
+    "malloc bin",
+    "malloc pages",
+    "free bin",
+    "free pages",
+};
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: fl-top [-d seconds] [-n iterations] [pid]\n");
+    fprintf(stderr, "  without a pid, the only process publishing stats is watched\n");
+    exit(2);
+}
+
+static int
+find_process()
+{
+    DIR* dir = opendir("/dev/shm");
+    struct dirent* entry;
+    const char* name = strrchr(STATS_PATH_PREFIX, '/') + 1;
+    int found = 0;
+    int pid = 0;
+
+    if (dir == NULL)
+    {
+        return 0;
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strncmp(entry->d_name, name, strlen(name)) != 0)
+        {
+            continue;
+        }
+
+        /* list every candidate once there is more than one */
+        if (++found == 2)
+        {
+            fprintf(stderr, "%d\n", pid);
+        }
+        pid = atoi(entry->d_name + strlen(name));
+        if (found >= 2)
+        {
+            fprintf(stderr, "%d\n", pid);
+        }
+    }
+    closedir(dir);
+
+    if (found != 1)
+    {
+        fprintf(stderr, found ? "fl-top: several processes publish stats, pick one\n"
+                              : "fl-top: no process publishes stats, run it with %s=1\n", STATS_ENV);
+        return 0;
+    }
+    return pid;
+}
+
+static const stats_segment*
+attach(int pid)
+{
+    char path[STATS_PATH_LENGTH];
+    const stats_segment* segment;
+    int fd;
+
+    snprintf(path, sizeof(path), STATS_PATH_PREFIX "%d", pid);
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        fprintf(stderr, "fl-top: cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    segment = mmap(NULL, sizeof(stats_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED)
+    {
+        fprintf(stderr, "fl-top: cannot map %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC || segment->version != STATS_VERSION)
+    {
+        fprintf(stderr, "fl-top: %s is not a stats segment of this version\n", path);
+        return NULL;
+    }
+    return segment;
+}
+
+static uint64_t
+percentile(const uint64_t* histogram, double fraction)
+{
+    uint64_t total = 0;
+    uint64_t seen = 0;
+    int i;
+
+    for (i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+    {
+        total += histogram[i];
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    /* report the upper bound of the bucket holding the percentile */
+    for (i = 0; i < STATS_HISTOGRAM_BUCKETS - 1; i++)
+    {
+        seen += histogram[i];
+        if (seen >= fraction * total)
+        {
+            break;
+        }
+    }
+    return 1UL << (i + 1);
+}
+
+static void
+print_latency(const char* name, const uint64_t* now, const uint64_t* before)
+{
+    uint64_t delta[STATS_HISTOGRAM_BUCKETS];
+
+    for (int i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+    {
+        delta[i] = now[i] - before[i];
+    }
+    printf("%-14s %12lu %12lu %12lu %12lu\n", name,
+           percentile(delta, 0.5), percentile(delta, 0.9), percentile(delta, 0.99), percentile(now, 0.99));
+}
+
+static void
+print_classes(const stats_segment* s)
+{
+    int order[STATS_CLASSES];
+    int shown = 0;
+
+    for (int i = 0; i < STATS_CLASSES; i++)
+    {
+        order[i] = i;
+    }
+
+    /* selection of the classes holding the most live bytes */
+    for (int i = 0; i < TOP_CLASSES && i < STATS_CLASSES; i++)
+    {
+        int best = i;
+        for (int j = i + 1; j < STATS_CLASSES; j++)
+        {
+            if (s->live_bytes[order[j]] > s->live_bytes[order[best]])
+            {
+                best = j;
+            }
+        }
+        int tmp = order[i];
+        order[i] = order[best];
+        order[best] = tmp;
+
+        if (s->live_bytes[order[i]] <= 0)
+        {
+            break;
+        }
+        shown++;
+    }
+
+    printf("%-14s %12s %12s\n", "class", "chunk size", "live bytes");
+    for (int i = 0; i < shown; i++)
+    {
+        int class = order[i];
+        if (class == STATS_PAGE_CLASS)
+        {
+            printf("%-14s %12s %12ld\n", "pages", "-", (long)s->live_bytes[class]);
+        }
+        else
+        {
+            printf("bin %-10d %12zu %12ld\n", class, get_bin_size(class), (long)s->live_bytes[class]);
+        }
+    }
+}
+
+int
+main(int argc, char** argv)
+{
+    const stats_segment* segment;
+    stats_segment now;
+    stats_segment before;
+    double delay = 1.0;
+    long iterations = -1;
+    int pid = 0;
+    int opt;
+    bool tty = isatty(STDOUT_FILENO);
+
+    while ((opt = getopt(argc, argv, "d:n:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                delay = atof(optarg);
+                break;
+            case 'n':
+                iterations = atol(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (optind < argc)
+    {
+        pid = atoi(argv[optind]);
+    }
+    else
+    {
+        pid = find_process();
+    }
+    if (pid <= 0 || delay <= 0)
+    {
+        usage();
+    }
+
+    segment = attach(pid);
+    if (segment == NULL)
+    {
+        return 1;
+    }
+
+    memcpy(&before, segment, sizeof(stats_segment));
+    while (iterations != 0)
+    {
+        usleep(delay * 1000000);
+        memcpy(&now, segment, sizeof(stats_segment));
+
+        if (tty)
+        {
+            printf("\033[H\033[2J");
+        }
+        printf("fl-top  pid %d  page %lu  every %.1fs\n\n", now.pid, now.page_size, delay);
+
+        printf("%-14s %12s %12s\n", "path", "total", "ops/s");
+        for (int i = 0; i < NUMBER_OF_STATS_PATHS; i++)
+        {
+            printf("%-14s %12lu %12.0f\n", path_names[i], now.ops[i], (now.ops[i] - before.ops[i]) / delay);
+        }
+
+        printf("\n%-14s %12s %12s\n", "syscall", "total", "calls/s");
+        printf("%-14s %12lu %12.0f\n", "mmap", now.mmap_calls, (now.mmap_calls - before.mmap_calls) / delay);
+        printf("%-14s %12lu %12.0f\n", "munmap", now.munmap_calls, (now.munmap_calls - before.munmap_calls) / delay);
+        printf("%-14s %12lu %12.0f\n", "mprotect", now.mprotect_calls,
+               (now.mprotect_calls - before.mprotect_calls) / delay);
+
+        printf("\n%-14s %12s %12s %12s %12s\n", "ticks", "p50", "p90", "p99", "p99 total");
+        print_latency("malloc", now.malloc_latency, before.malloc_latency);
+        print_latency("free", now.free_latency, before.free_latency);
+
+        printf("\n");
+        print_classes(&now);
+        fflush(stdout);
+
+        before = now;
+        if (iterations > 0)
+        {
+            iterations--;
+        }
+
+        if (kill(pid, 0) == -1 && errno == ESRCH)
+        {
+            printf("\nprocess %d exited\n", pid);
+            break;
+        }
+    }
+
+    return 0;
+}
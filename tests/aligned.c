@@ -0,0 +1,99 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fl.h>
+#include <check.h>
+#include "test.h"
+
+#define ROUNDS 64
+
+void* operator_new_aligned(size_t size, size_t alignment) __asm__("_ZnwmSt11align_val_t");
+void operator_delete_sized_aligned(void* addr, size_t size, size_t alignment) __asm__("_ZdlPvmSt11align_val_t");
+
+/*
+ * Alignments above 16 bytes, from bin chunks while a bin has them and from pages beyond,
+ * through aligned_alloc(), posix_memalign() and the aligned operator new. Alignments
+ * above the page size come from pages placed on the boundary.
+ */
+int
+main()
+{
+    static void* buffers[ROUNDS];
+    heap_report report;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+
+    for (size_t alignment = 32; alignment <= page_size; alignment *= 2)
+    {
+        for (size_t size = 1; size <= 3 * alignment; size += alignment / 2 + 5)
+        {
+            for (int i = 0; i < ROUNDS; i++)
+            {
+                buffers[i] = aligned_alloc(alignment, size);
+                expect(buffers[i] != NULL);
+                expect((uintptr_t)buffers[i] % alignment == 0);
+                memset(buffers[i], 0x5A, size);
+            }
+            expect(fl_check_heap(&report) == 0);
+            for (int i = 0; i < ROUNDS; i++)
+            {
+                free(buffers[i]);
+            }
+
+            expect(posix_memalign(&buffers[0], alignment, size) == 0);
+            expect((uintptr_t)buffers[0] % alignment == 0);
+            free(buffers[0]);
+
+            buffers[0] = operator_new_aligned(size, alignment);
+            expect((uintptr_t)buffers[0] % alignment == 0);
+            memset(buffers[0], 0x5A, size);
+            operator_delete_sized_aligned(buffers[0], size, alignment);
+        }
+    }
+
+    for (size_t alignment = 2 * page_size; alignment <= 16 * page_size; alignment *= 2)
+    {
+        for (size_t size = 1; size <= 2 * alignment; size += alignment / 2 + page_size + 5)
+        {
+            for (int i = 0; i < ROUNDS; i++)
+            {
+                buffers[i] = aligned_alloc(alignment, size);
+                expect(buffers[i] != NULL);
+                expect((uintptr_t)buffers[i] % alignment == 0);
+                memset(buffers[i], 0x5A, size);
+            }
+            expect(fl_check_heap(&report) == 0);
+            for (int i = 0; i < ROUNDS; i += 2)
+            {
+                free(buffers[i]);
+            }
+            for (int i = 1; i < ROUNDS; i += 2)
+            {
+                free_aligned_sized(buffers[i], alignment, size);
+            }
+
+            expect(posix_memalign(&buffers[0], alignment, size) == 0);
+            expect((uintptr_t)buffers[0] % alignment == 0);
+            free(buffers[0]);
+
+            buffers[0] = operator_new_aligned(size, alignment);
+            expect((uintptr_t)buffers[0] % alignment == 0);
+            memset(buffers[0], 0x5A, size);
+            operator_delete_sized_aligned(buffers[0], size, alignment);
+            expect(fl_check_heap(&report) == 0);
+        }
+    }
+
+    /* an invalid alignment is told apart from a request that cannot be served */
+    expect(posix_memalign(&buffers[0], 24, 100) == EINVAL);
+    expect(posix_memalign(&buffers[0], 4, 100) == EINVAL);
+    expect(posix_memalign(&buffers[0], page_size, SIZE_MAX - page_size) == ENOMEM);
+
+    /* a small aligned buffer comes from a bin page, not from pages of its own */
+    buffers[0] = aligned_alloc(64, 100);
+    expect((uintptr_t)buffers[0] % page_size != 0);
+    free(buffers[0]);
+
+    expect(fl_check_heap(&report) == 0);
+    return 0;
+}
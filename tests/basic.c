@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <check.h>
+#include "test.h"
+
+#define BUFFERS 2000
+
+/*
+ * Every entry point of the library on bin chunks and pages, then a clean heap check.
+ * Built against the optimized FL_PAGE_SIZE library as well.
+ */
+int
+main()
+{
+    static void* buffers[BUFFERS];
+    heap_report report;
+    void* aligned = NULL;
+    char* grown;
+
+    for (int i = 0; i < BUFFERS; i++)
+    {
+        size_t size = (i * 37) % 9000;
+        buffers[i] = malloc(size);
+        expect(buffers[i] != NULL);
+        expect((uintptr_t)buffers[i] % 16 == 0);
+        memset(buffers[i], i, size);
+    }
+
+    for (int i = 0; i < BUFFERS; i += 2)
+    {
+        free(buffers[i]);
+    }
+
+    grown = calloc(100, 3);
+    expect(grown != NULL);
+    for (int i = 0; i < 300; i++)
+    {
+        expect(grown[i] == 0);
+    }
+    memset(grown, 7, 300);
+    grown = realloc(grown, 20000);
+    expect(grown != NULL && grown[0] == 7 && grown[299] == 7);
+
+    expect(posix_memalign(&aligned, 256, 1000) == 0);
+    expect((uintptr_t)aligned % 256 == 0);
+    free(aligned);
+    aligned = aligned_alloc(4096, 100);
+    expect(aligned != NULL && (uintptr_t)aligned % 4096 == 0);
+    free(aligned);
+
+    expect(fl_check_heap(&report) == 0);
+
+    for (int i = 1; i < BUFFERS; i += 2)
+    {
+        for (size_t j = 0; j < (i * 37) % 9000; j++)
+        {
+            expect(((unsigned char*)buffers[i])[j] == (unsigned char)i);
+        }
+        free(buffers[i]);
+    }
+    free(grown);
+
+    expect(fl_check_heap(&report) == 0);
+    expect(report.slots > 0);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <fl.h>
+#include <check.h>
+#include "test.h"
+
+#define BATCH 1000
+
+/* n distinct, aligned and writable buffers of the size */
+static void
+expect_buffers(void** buffers, size_t n, size_t size)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        expect(buffers[i] != NULL && (uintptr_t)buffers[i] % 16 == 0);
+        memset(buffers[i], (int)i, size);
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        expect(((unsigned char*)buffers[i])[0] == (unsigned char)i);
+        expect(((unsigned char*)buffers[i])[size - 1] == (unsigned char)i);
+    }
+}
+
+/*
+ * Batches of bin chunks and of pages, freed by batch and one by one, and batches
+ * that cannot be served.
+ */
+int
+main()
+{
+    static void* buffers[BATCH];
+    heap_report report;
+    size_t slots;
+    size_t heap_size;
+
+    /* an empty batch returns before the heap is touched, here it is not even set up yet */
+    expect(fl_malloc_batch(10000, 0, buffers) == 0);
+    expect(fl_check_heap(&report) == 0 && report.heap_size == 0);
+
+    /* more chunks than a slab holds */
+    expect(fl_malloc_batch(48, BATCH, buffers) == BATCH);
+    expect_buffers(buffers, BATCH, 48);
+    expect(fl_check_heap(&report) == 0);
+    fl_free_batch(buffers, BATCH);
+
+    /* pages carved one after the other, freed one by one */
+    expect(fl_malloc_batch(10000, 100, buffers) == 100);
+    expect_buffers(buffers, 100, 10000);
+    expect(fl_check_heap(&report) == 0);
+    for (int i = 0; i < 100; i++)
+    {
+        free(buffers[i]);
+    }
+
+    /* buffers of malloc() freed by batch, NULL entries skipped */
+    for (int i = 0; i < BATCH; i++)
+    {
+        buffers[i] = (i % 3 == 0) ? NULL : malloc(i % 2 ? 200 : 6000);
+    }
+    fl_free_batch(buffers, BATCH);
+    fl_free_batch(buffers, 0);
+
+    /* an empty batch takes nothing from the heap, not even for pages */
+    expect(fl_check_heap(&report) == 0);
+    slots = report.slots;
+    heap_size = report.heap_size;
+    expect(fl_malloc_batch(16, 0, buffers) == 0);
+    expect(fl_malloc_batch(3000, 0, buffers) == 0);
+    expect(fl_malloc_batch(64 * 1024 * 1024, 0, buffers) == 0);
+    expect(fl_check_heap(&report) == 0);
+    expect(report.slots == slots && report.heap_size == heap_size);
+    expect(fl_malloc_batch(SIZE_MAX / 2, 4, buffers) == 0);
+
+    expect(fl_check_heap(&report) == 0);
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <fl.h>
+#include <check.h>
+#include "test.h"
+
+#define CHUNKS   40000
+#define CHURN    64
+
+static volatile bool stop = false;
+
+/* allocates and frees next to the check, which must never see the heap in between */
+static void*
+churn(void* arg)
+{
+    void* buffers[CHURN];
+
+    (void)arg;
+    while (!stop)
+    {
+        for (int i = 0; i < CHURN; i++)
+        {
+            buffers[i] = malloc(16 + (i * 97) % 3000);
+        }
+        for (int i = 0; i < CHURN; i++)
+        {
+            free(buffers[i]);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Enough bin slabs for several workers, checked while another thread keeps using
+ * the heap, then with one corrupted canary.
+ */
+int
+main()
+{
+    static void* chunks[CHUNKS];
+    heap_report report;
+    pthread_t thread;
+    unsigned char* canary;
+    unsigned char saved;
+    bin_slab* slab;
+    bin_slab* next;
+
+    for (int i = 0; i < CHUNKS; i++)
+    {
+        chunks[i] = malloc(2000);
+        expect(chunks[i] != NULL);
+    }
+
+    expect(fl_check_heap(&report) == 0);
+    expect(report.slots > HEAP_CHECK_WORKER_SLOTS);
+    expect(report.bin_chunks >= CHUNKS);
+    if (sysconf(_SC_NPROCESSORS_ONLN) > 1)
+    {
+        expect(report.workers > 1);
+    }
+
+    expect(pthread_create(&thread, NULL, churn, NULL) == 0);
+    for (int i = 0; i < 10; i++)
+    {
+        expect(fl_check_heap(&report) == 0);
+    }
+    stop = true;
+    expect(pthread_join(thread, NULL) == 0);
+
+    /* the canary bytes sit right before the buffer */
+    canary = (unsigned char*)chunks[CHUNKS - 1] - 1;
+    saved = *canary;
+    *canary = saved + 1;
+    expect(fl_check_heap(&report) == 1);
+    expect(report.count[HEAP_BIN_CANARY] == 1);
+    expect(report.faults == 1 && report.fault[0].address == chunks[CHUNKS - 1]);
+    *canary = saved;
+
+    for (int i = 0; i < CHUNKS; i++)
+    {
+        free(chunks[i]);
+    }
+    expect(fl_check_heap(&report) == 0);
+
+    /* the slab of the last freed chunk heads the empty slabs, its link is followed too */
+    chunks[0] = malloc(700);
+    free(chunks[0]);
+    slab = (bin_slab*)((uintptr_t)chunks[0] & ~(sysconf(_SC_PAGESIZE) - 1));
+    expect(slab->list == SLAB_EMPTY && slab->prev == NULL);
+    next = slab->next;
+    slab->next = (bin_slab*)chunks[0];
+    expect(fl_check_heap(&report) == 1);
+    expect(report.count[HEAP_BIN_LINK] == 1);
+    slab->next = next;
+
+    /* an empty slab with a chunk counted as handed out */
+    slab->live = 1;
+    expect(fl_check_heap(&report) >= 1);
+    expect(report.count[HEAP_BIN_SLAB] >= 1);
+    slab->live = 0;
+    expect(fl_check_heap(&report) == 0);
+    return 0;
+}
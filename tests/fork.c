@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <check.h>
+#include "test.h"
+
+#define THREADS 4
+#define FORKS   200
+#define CHURN   64
+
+static volatile bool stop = false;
+
+/* keeps the heap lock and the queue of frees busy while the main thread forks */
+static void*
+churn(void* arg)
+{
+    void* buffers[CHURN];
+
+    (void)arg;
+    while (!stop)
+    {
+        for (int i = 0; i < CHURN; i++)
+        {
+            buffers[i] = malloc(16 + (i * 131) % 9000);
+        }
+        for (int i = 0; i < CHURN; i++)
+        {
+            free(buffers[i]);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Fork while other threads allocate and free: every child finds the heap free and
+ * consistent, it would hang on the lock of a thread it does not have otherwise.
+ */
+int
+main()
+{
+    pthread_t threads[THREADS];
+    heap_report report;
+    int status;
+
+    for (int i = 0; i < THREADS; i++)
+    {
+        expect(pthread_create(&threads[i], NULL, churn, NULL) == 0);
+    }
+
+    for (int i = 0; i < FORKS; i++)
+    {
+        pid_t pid = fork();
+
+        expect(pid != -1);
+        if (pid == 0)
+        {
+            void* buffers[CHURN];
+
+            /* a hung child is killed rather than left to stall the test */
+            alarm(10);
+            for (int j = 0; j < CHURN; j++)
+            {
+                buffers[j] = malloc(16 + (j * 131) % 9000);
+            }
+            for (int j = 0; j < CHURN; j++)
+            {
+                free(buffers[j]);
+            }
+            _exit(fl_check_heap(&report) == 0 ? 0 : 2);
+        }
+        expect(waitpid(pid, &status, 0) == pid);
+        expect(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    stop = true;
+    for (int i = 0; i < THREADS; i++)
+    {
+        expect(pthread_join(threads[i], NULL) == 0);
+    }
+    expect(fl_check_heap(&report) == 0);
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <fl.h>
+#include <check.h>
+#include <report.h>
+#include "test.h"
+
+/* the errors of one kind since the last call */
+static uint64_t
+faults_of(fault_kind kind)
+{
+    static fault_counters last;
+    fault_counters now;
+    uint64_t count;
+
+    fl_fault_counters(&now);
+    count = now.count[kind] - last.count[kind];
+    last.count[kind] = now.count[kind];
+    return count;
+}
+
+/*
+ * Run with FL_ON_ERROR=continue: sized frees of the right size release bin chunks and
+ * pages, a wrong size is a size mismatch and the buffer stays allocated.
+ */
+int
+main()
+{
+    heap_report report;
+    char* small = malloc(100);
+    char* large = malloc(20000);
+    char* aligned = aligned_alloc(256, 1000);
+    char* wrong_small = malloc(100);
+    char* wrong_large = malloc(20000);
+
+    expect(small && large && aligned && wrong_small && wrong_large);
+
+    free_sized(small, 100);
+    free_sized(large, 20000);
+    free_aligned_sized(aligned, 256, 1000);
+    free_sized(NULL, 10);
+    expect(faults_of(FAULT_SIZE_MISMATCH) == 0 && faults_of(FAULT_INVALID_FREE) == 0);
+
+    /* a chunk given the size of pages, pages given another size and a chunk of another bin */
+    free_sized(wrong_small, 20000);
+    expect(faults_of(FAULT_SIZE_MISMATCH) == 1);
+    free_sized(wrong_large, 19999);
+    expect(faults_of(FAULT_SIZE_MISMATCH) == 1);
+    free_sized(wrong_large, 100);
+    expect(faults_of(FAULT_SIZE_MISMATCH) == 1);
+    free_sized(wrong_small, 1000);
+    expect(faults_of(FAULT_SIZE_MISMATCH) == 1);
+
+    /* the buffers were left alone, the right size still frees them */
+    memset(wrong_small, 1, 100);
+    memset(wrong_large, 1, 20000);
+    free_sized(wrong_small, 100);
+    free_sized(wrong_large, 20000);
+    expect(faults_of(FAULT_SIZE_MISMATCH) == 0);
+
+    /* freed pages are merged into a free span, freeing them again is still a double free */
+    free_sized(wrong_small, 100);
+    free_sized(wrong_large, 20000);
+    expect(faults_of(FAULT_DOUBLE_FREE) == 2 && faults_of(FAULT_INVALID_FREE) == 0);
+
+    expect(fl_check_heap(&report) == 0);
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <check.h>
+#include "test.h"
+
+#define SIZE 5000
+
+/* touches one byte in a child, the parent learns whether it faulted */
+static bool
+faults(volatile char* byte)
+{
+    int status;
+    pid_t pid = fork();
+
+    expect(pid != -1);
+    if (pid == 0)
+    {
+        *byte = 1;
+        _exit(0);
+    }
+    expect(waitpid(pid, &status, 0) == pid);
+    return WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV;
+}
+
+/*
+ * Run "leading" without FL_GUARD and "trailing" with FL_GUARD=trailing: the guard
+ * page sits right before, or right after the buffer rounded to 16 bytes.
+ */
+int
+main(int argc, char** argv)
+{
+    heap_report report;
+    bool trailing = argc > 1 && strcmp(argv[1], "trailing") == 0;
+    char* buffer = malloc(SIZE);
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    expect(buffer != NULL && (uintptr_t)buffer % 16 == 0);
+    memset(buffer, 1, SIZE);
+
+    if (trailing)
+    {
+        expect((uintptr_t)buffer % page_size != 0);
+        expect(faults(&buffer[(SIZE + 15) / 16 * 16]));
+        expect(!faults(&buffer[-1]));
+    }
+    else
+    {
+        expect((uintptr_t)buffer % page_size == 0);
+        expect(faults(&buffer[-1]));
+    }
+    expect(!faults(&buffer[0]) && !faults(&buffer[SIZE - 1]));
+
+    /* free() and the heap check still tell the buffer apart from a bin chunk */
+    expect(fl_check_heap(&report) == 0);
+    free(buffer);
+    expect(fl_check_heap(&report) == 0);
+    return 0;
+}
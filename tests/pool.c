@@ -0,0 +1,93 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <check.h>
+#include <pool.h>
+#include <report.h>
+#include "test.h"
+
+#define OBJECTS 3000
+
+/* the errors of one kind since the last call */
+static uint64_t
+faults_of(fault_kind kind)
+{
+    static fault_counters last;
+    fault_counters now;
+    uint64_t count;
+
+    fl_fault_counters(&now);
+    count = now.count[kind] - last.count[kind];
+    last.count[kind] = now.count[kind];
+    return count;
+}
+
+/*
+ * Run with FL_ON_ERROR=continue: objects over several slabs are handed out aligned and
+ * reused, every misuse of a pool object is reported as what it is.
+ */
+int
+main()
+{
+    static char* objects[OBJECTS];
+    heap_report report;
+    fl_pool* pool;
+    fl_pool* other;
+    char* object;
+    uint8_t saved;
+
+    free(malloc(1));
+
+    pool = fl_pool_create(100, 64);
+    other = fl_pool_create(100, 0);
+    expect(pool != NULL && other != NULL);
+    expect(fl_pool_create(100, 48) == NULL);
+
+    /* more objects than one slab holds */
+    for (int i = 0; i < OBJECTS; i++)
+    {
+        objects[i] = fl_pool_alloc(pool);
+        expect(objects[i] != NULL && (uintptr_t)objects[i] % 64 == 0);
+        memset(objects[i], i, 100);
+    }
+    for (int i = 0; i < OBJECTS; i++)
+    {
+        expect(objects[i][0] == (char)i && objects[i][99] == (char)i);
+    }
+    for (int i = 0; i < OBJECTS; i += 2)
+    {
+        fl_pool_free(pool, objects[i]);
+    }
+
+    /* the last freed object is handed out first */
+    object = fl_pool_alloc(pool);
+    expect(object == objects[OBJECTS - 2]);
+    fl_pool_free(pool, object);
+    fl_pool_free(pool, NULL);
+    expect(faults_of(FAULT_DOUBLE_FREE) == 0 && faults_of(FAULT_INVALID_FREE) == 0 && faults_of(FAULT_CANARY) == 0);
+
+    /* misuses are reported, the object is left alone */
+    fl_pool_free(pool, objects[0]);
+    expect(faults_of(FAULT_DOUBLE_FREE) == 1);
+    fl_pool_free(other, objects[1]);
+    expect(faults_of(FAULT_INVALID_FREE) == 1);
+    free(objects[3]);
+    expect(faults_of(FAULT_INVALID_FREE) == 1);
+    expect(realloc(objects[5], 200) == NULL);
+    expect(faults_of(FAULT_INVALID_FREE) == 1 && faults_of(FAULT_CANARY) == 0);
+    expect(objects[5][0] == 5 && objects[5][99] == 5);
+
+    saved = objects[7][-1];
+    objects[7][-1] = 0;
+    fl_pool_free(pool, objects[7]);
+    expect(faults_of(FAULT_CANARY) == 1);
+    objects[7][-1] = saved;
+
+    fl_pool_destroy(pool);
+    fl_pool_destroy(other);
+    expect(faults_of(FAULT_CANARY) == 0);
+
+    /* the slabs went back to the heap */
+    expect(fl_check_heap(&report) == 0);
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include <check.h>
+#include <profile.h>
+#include "test.h"
+
+#define CHUNKS 5000
+
+/*
+ * Run "cold" then "warm" or "idle" with the same FL_PROFILE: the later runs find the
+ * bin pages of the cold run's peak already carved when main() starts. The idle run
+ * never needs them, they go back to the pool once enough small frees went by. Run
+ * "damaged pages" or "damaged chunks" to start from a profile with a peak no run
+ * could reach, which is ignored.
+ */
+int
+main(int argc, char** argv)
+{
+    static void* chunks[CHUNKS];
+    heap_report report;
+    bool warm = argc > 1 && strcmp(argv[1], "warm") == 0;
+    bool idle = argc > 1 && strcmp(argv[1], "idle") == 0;
+    bool damaged = argc > 2 && strcmp(argv[1], "damaged") == 0;
+
+    /* written before the first allocation, which reads the profile */
+    if (damaged)
+    {
+        static profile_data data;
+        int fd;
+
+        data.magic = PROFILE_MAGIC;
+        data.version = PROFILE_VERSION;
+        data.page_size = sysconf(_SC_PAGESIZE);
+        if (strcmp(argv[2], "pages") == 0)
+        {
+            data.peak_pages = INT64_MAX / 2;
+        }
+        else
+        {
+            data.peak_chunks[0] = INT64_MAX;
+        }
+        fd = open(getenv(PROFILE_ENV), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        expect(fd != -1 && write(fd, &data, sizeof(data)) == sizeof(data));
+        close(fd);
+    }
+
+    /* the heap is set up by the first allocation */
+    free(malloc(1));
+    expect(fl_check_heap(&report) == 0);
+    if (warm || idle)
+    {
+        expect(report.bin_chunks >= CHUNKS);
+    }
+    else
+    {
+        expect(report.bin_chunks < CHUNKS);
+    }
+
+    if (idle)
+    {
+        /* another size class, one chunk at a time, more small frees than BIN_EMPTY_DELAY */
+        for (int i = 0; i < CHUNKS; i++)
+        {
+            free(malloc(200));
+        }
+        expect(fl_check_heap(&report) == 0);
+        expect(report.bin_chunks < CHUNKS / 2);
+        return 0;
+    }
+
+    for (int i = 0; i < CHUNKS; i++)
+    {
+        chunks[i] = malloc(48);
+        expect(chunks[i] != NULL);
+    }
+    for (int i = 0; i < CHUNKS; i++)
+    {
+        free(chunks[i]);
+    }
+
+    /* the slabs emptied by the frees went back to the pool but a few */
+    expect(fl_check_heap(&report) == 0);
+    expect(report.bin_chunks < CHUNKS / 2);
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <check.h>
+#include <region.h>
+#include <report.h>
+#include "test.h"
+
+#define OBJECTS 5000
+
+/*
+ * Run with FL_ON_ERROR=continue: objects of a region die together, a large object
+ * ends against its guard page and a checked region reports a corrupted canary.
+ */
+int
+main()
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t large = 20 * page_size;
+    heap_report before;
+    heap_report after;
+    fault_counters counters;
+    fl_region* region;
+    char* object;
+    pid_t child;
+    int status;
+
+    free(malloc(1));
+    expect(fl_check_heap(&before) == 0);
+
+    /* many spans, released in one pass */
+    region = fl_region_create(0, false);
+    expect(region != NULL);
+    for (int i = 0; i < OBJECTS; i++)
+    {
+        object = fl_region_alloc(region, 1 + i % 200);
+        expect(object != NULL && (uintptr_t)object % 16 == 0);
+        memset(object, i, 1 + i % 200);
+    }
+    object = fl_region_alloc(region, large);
+    expect(object != NULL);
+    expect(((uintptr_t)object + large) % page_size == 0);
+    memset(object, 1, large);
+
+    /* an overrun of the large object faults at once */
+    child = fork();
+    expect(child != -1);
+    if (child == 0)
+    {
+        object[large] = 1;
+        _exit(0);
+    }
+    expect(waitpid(child, &status, 0) == child);
+    expect(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+
+    fl_region_destroy(region);
+    expect(fl_check_heap(&after) == 0);
+    expect(after.slots <= before.slots + 1);
+
+    /* a checked region finds an overrun at destroy time */
+    region = fl_region_create(0, true);
+    object = fl_region_alloc(region, 40);
+    expect(fl_region_alloc(region, 40) != NULL);
+    object[48] = 0;
+    fl_region_destroy(region);
+    fl_fault_counters(&counters);
+    expect(counters.count[FAULT_CANARY] == 1);
+
+    expect(fl_check_heap(&after) == 0);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <check.h>
+#include <lock.h>
+#include "test.h"
+
+#define THREADS 4
+#define BUFFERS 3000
+
+static void* buffers[THREADS][BUFFERS];
+
+static void*
+free_all(void* arg)
+{
+    void** mine = arg;
+
+    for (int i = 0; i < BUFFERS; i++)
+    {
+        free(mine[i]);
+    }
+    return NULL;
+}
+
+/*
+ * Threads free more buffers than the queue holds while the heap is held elsewhere:
+ * they queue what fits, then wait for the heap, and every buffer is released.
+ */
+int
+main()
+{
+    pthread_t threads[THREADS];
+    heap_report before;
+    heap_report after;
+
+    for (int t = 0; t < THREADS; t++)
+    {
+        for (int i = 0; i < BUFFERS; i++)
+        {
+            buffers[t][i] = malloc(48);
+            expect(buffers[t][i] != NULL);
+            memset(buffers[t][i], t, 48);
+        }
+    }
+    expect(fl_check_heap(&before) == 0);
+
+    heap_lock();
+    for (int t = 0; t < THREADS; t++)
+    {
+        expect(pthread_create(&threads[t], NULL, free_all, buffers[t]) == 0);
+    }
+    usleep(100 * 1000);
+    expect(remote_free_pending());
+    heap_unlock();
+
+    for (int t = 0; t < THREADS; t++)
+    {
+        expect(pthread_join(threads[t], NULL) == 0);
+    }
+
+    /* the next thread to take the heap releases what is still queued */
+    free(malloc(48));
+    expect(!remote_free_pending());
+    expect(fl_check_heap(&after) == 0);
+    expect(after.bin_chunks < before.bin_chunks / 2);
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+
+#include <report.h>
+#include "test.h"
+
+#define INVALID 40
+
+/*
+ * Run "continue" with FL_ON_ERROR=continue: errors are counted, an address is reported
+ * once per kind and at most REPORT_PER_SECOND reports are printed per second. Run
+ * "abort" without it: the first error stops the process.
+ */
+int
+main(int argc, char** argv)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    bool keep_going = argc > 1 && strcmp(argv[1], "continue") == 0;
+    fault_counters counters;
+    char* pages;
+    char* volatile buffer = malloc(100);
+    char* volatile large;
+
+    expect(buffer != NULL);
+    free(buffer);
+    free(buffer);
+    if (!keep_going)
+    {
+        test_write("survived a double free\n");
+        return 0;
+    }
+
+    /* the same error again is a duplicate */
+    free(buffer);
+    fl_fault_counters(&counters);
+    expect(counters.count[FAULT_DOUBLE_FREE] == 2);
+    expect(counters.reported == 1 && counters.duplicates == 1);
+
+    /* the pages of a freed buffer are merged into a free span, freeing them again is still a double free */
+    large = malloc(20000);
+    expect(large != NULL);
+    free(large);
+    free(large);
+    free(large);
+    fl_fault_counters(&counters);
+    expect(counters.count[FAULT_DOUBLE_FREE] == 4 && counters.count[FAULT_INVALID_FREE] == 0);
+    expect(counters.reported == 2 && counters.duplicates == 2);
+
+    /* pages the heap never handed out, each one a new address */
+    pages = mmap(NULL, INVALID * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    expect(pages != MAP_FAILED);
+    for (int i = 0; i < INVALID; i++)
+    {
+        free(pages + i * page_size);
+    }
+
+    fl_fault_counters(&counters);
+    expect(counters.count[FAULT_INVALID_FREE] == INVALID);
+    expect(counters.duplicates == 2);
+    expect(counters.reported + counters.suppressed == INVALID + 2);
+    /* the burst may straddle two one second windows */
+    expect(counters.reported <= 2 * REPORT_PER_SECOND);
+    expect(counters.suppressed >= INVALID + 2 - 2 * REPORT_PER_SECOND);
+
+    /* the heap goes on serving */
+    buffer = malloc(100);
+    expect(buffer != NULL);
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+
+#include <fl.h>
+#include <sample.h>
+#include "test.h"
+
+#define PROFILE_BYTES (1 << 20)
+
+void* operator_new(size_t size) __asm__("_Znwm");
+void operator_delete(void* addr) __asm__("_ZdlPv");
+
+static void* kept[8];
+
+void allocate_here();
+
+/* every entry point, called from here so that each sample must start in this function */
+__attribute__((noinline)) void
+allocate_here()
+{
+    kept[0] = malloc(100);
+    kept[1] = calloc(10, 10);
+    kept[2] = realloc(malloc(10), 5000);
+    kept[3] = aligned_alloc(64, 64);
+    kept[4] = operator_new(200);
+    expect(fl_malloc_batch(48, 3, &kept[5]) == 3);
+}
+
+/*
+ * Run without FL_SAMPLE_RATE sampling is off, run with FL_SAMPLE_RATE=1 every allocation
+ * is sampled and its stack starts at its caller, whatever the entry point.
+ */
+int
+main()
+{
+    static char profile[PROFILE_BYTES];
+    char path[] = "sample.heap";
+    ssize_t length;
+    size_t samples = 0;
+    size_t batches = 0;
+    char* line;
+    char* next;
+    char* at;
+    Dl_info info;
+    int fd;
+
+    /* the heap, and the sampler with it, is set up by the first allocation */
+    free(malloc(1));
+    allocate_here();
+
+    if (getenv(SAMPLE_RATE_ENV) == NULL)
+    {
+        expect(sample_rate == 0 && sample_live == 0);
+        return 0;
+    }
+
+    expect(sample_live >= 6);
+    expect(fl_heap_profile_dump(path) == 0);
+    fd = open(path, O_RDONLY);
+    expect(fd != -1);
+    length = read(fd, profile, sizeof(profile) - 1);
+    expect(length > 0);
+    profile[length] = '\0';
+    close(fd);
+
+    /* after the header line, a sample line per live sample then the mappings */
+    strtok_r(profile, "\n", &next);
+    while ((line = strtok_r(NULL, "\n", &next)) != NULL && (at = strstr(line, "] @ ")) != NULL)
+    {
+        expect(dladdr((void*)strtoull(at + 4, NULL, 16), &info) != 0);
+        expect(info.dli_sname != NULL && strcmp(info.dli_sname, "allocate_here") == 0);
+        /* the batch is one sample of all its bytes */
+        if (strtoull(strchr(line, ':') + 1, NULL, 10) == 3 * 48)
+        {
+            batches++;
+        }
+        samples++;
+    }
+    expect(samples >= 6);
+    expect(batches == 1);
+
+    free(kept[0]);
+    free(kept[1]);
+    free(kept[2]);
+    free(kept[3]);
+    operator_delete(kept[4]);
+    fl_free_batch(&kept[5], 3);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <check.h>
+#include "test.h"
+
+#define BUFFERS 4000
+
+/*
+ * Page allocations by the thousand, far more slots than the first page of the slot
+ * list holds: the list grows several times while every slot keeps its buffer.
+ */
+int
+main()
+{
+    static char* buffers[BUFFERS];
+    heap_report report;
+
+    for (int i = 0; i < BUFFERS; i++)
+    {
+        size_t size = 5000 + (i % 7) * 4096;
+
+        buffers[i] = malloc(size);
+        expect(buffers[i] != NULL);
+        buffers[i][0] = (char)i;
+        buffers[i][size - 1] = (char)i;
+    }
+
+    expect(fl_check_heap(&report) == 0);
+    expect(report.slots > BUFFERS);
+
+    /* every other one freed leaves free spans between live ones, reused by the next round */
+    for (int i = 0; i < BUFFERS; i += 2)
+    {
+        free(buffers[i]);
+    }
+    expect(fl_check_heap(&report) == 0);
+    for (int i = 0; i < BUFFERS; i += 2)
+    {
+        buffers[i] = malloc(5000);
+        expect(buffers[i] != NULL);
+        buffers[i][0] = (char)i;
+        buffers[i][4999] = (char)i;
+    }
+    expect(fl_check_heap(&report) == 0);
+
+    for (int i = 0; i < BUFFERS; i++)
+    {
+        size_t size = (i % 2 == 0) ? 5000 : 5000 + (i % 7) * 4096;
+
+        expect(buffers[i][0] == (char)i && buffers[i][size - 1] == (char)i);
+        free(buffers[i]);
+    }
+
+    /* the spans of the freed buffers are coalesced again */
+    expect(fl_check_heap(&report) == 0);
+    expect(report.slots < BUFFERS / 4);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include <stats.h>
+#include "test.h"
+
+static void
+segment_path(char* path, int pid)
+{
+    char digits[12];
+    int i = sizeof(digits) - 1;
+
+    digits[i] = '\0';
+    do
+    {
+        digits[--i] = '0' + pid % 10;
+        pid /= 10;
+    }
+    while (pid > 0);
+    strcpy(path, STATS_PATH_PREFIX);
+    strcat(path, &digits[i]);
+}
+
+static bool
+exists(int pid)
+{
+    char path[STATS_PATH_LENGTH];
+
+    segment_path(path, pid);
+    return access(path, F_OK) == 0;
+}
+
+/*
+ * Run with FL_STATS: a forked child publishes in its own segment, and its exit
+ * removes its own file but not the one of its parent.
+ */
+int
+main()
+{
+    stats_segment* parent;
+    int status;
+    pid_t child;
+
+    free(malloc(100));
+    expect(stats != NULL && stats->pid == getpid());
+    expect(exists(getpid()));
+    parent = stats;
+
+    child = fork();
+    expect(child != -1);
+    if (child == 0)
+    {
+        free(malloc(100));
+        expect(stats != NULL && stats != parent && stats->pid == getpid());
+        expect(exists(getpid()));
+        exit(0);
+    }
+
+    expect(waitpid(child, &status, 0) == child);
+    expect(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    expect(!exists(child));
+    expect(exists(getpid()));
+    expect(stats == parent && stats->pid == getpid());
+    return 0;
+}
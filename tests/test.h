@@ -0,0 +1,54 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Stop the test with a failure unless the condition holds
+ *
+ * The message goes through write() rather than stdio, whose buffers come from the
+ * heap under test.
+ */
+#define expect(condition)                                                  \
+    do                                                                     \
+    {                                                                      \
+        if (!(condition))                                                  \
+        {                                                                  \
+            test_fail(__FILE__, __LINE__, #condition);                     \
+        }                                                                  \
+    }                                                                      \
+    while (0)
+
+static inline void
+test_write(const char* s)
+{
+    ssize_t unused = write(2, s, strlen(s));
+    (void)unused;
+}
+
+static inline void
+test_fail(const char* file, int line, const char* condition)
+{
+    char digits[12];
+    int i = sizeof(digits) - 1;
+
+    digits[i] = '\0';
+    do
+    {
+        digits[--i] = '0' + line % 10;
+        line /= 10;
+    }
+    while (line > 0);
+
+    test_write(file);
+    test_write(":");
+    test_write(&digits[i]);
+    test_write(": expected ");
+    test_write(condition);
+    test_write("\n");
+    _exit(1);
+}
+
+#endif // TEST_H
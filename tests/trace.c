@@ -0,0 +1,72 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <trace.h>
+#include "test.h"
+
+#define THREADS 4
+
+static void*
+churn(void* arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        free(malloc(64));
+        free(malloc(10000));
+    }
+    return NULL;
+}
+
+static void
+verify(const char* path)
+{
+    trace_header header;
+    trace_record record;
+    struct stat st;
+    uint64_t records;
+    int fd = open(path, O_RDONLY);
+
+    expect(fd != -1);
+    expect(read(fd, &header, sizeof(header)) == sizeof(header));
+    expect(header.magic == TRACE_MAGIC && header.record_size == sizeof(trace_record));
+
+    /* the file ends right after the records it holds */
+    records = header.written < header.capacity ? header.written : header.capacity;
+    expect(records > 0);
+    expect(fstat(fd, &st) == 0);
+    expect((uint64_t)st.st_size == sizeof(header) + records * sizeof(trace_record));
+
+    for (uint64_t i = 0; i < records; i++)
+    {
+        expect(read(fd, &record, sizeof(record)) == sizeof(record));
+        expect(record.op == TRACE_MALLOC || record.op == TRACE_FREE);
+    }
+    close(fd);
+}
+
+/*
+ * Run with FL_TRACE, the process exits while threads keep allocating: recording
+ * stops before the file is cut. Then "verify <file>" reads the file back.
+ */
+int
+main(int argc, char** argv)
+{
+    pthread_t thread;
+
+    if (argc == 3 && strcmp(argv[1], "verify") == 0)
+    {
+        verify(argv[2]);
+        return 0;
+    }
+
+    for (int t = 0; t < THREADS; t++)
+    {
+        expect(pthread_create(&thread, NULL, churn, NULL) == 0);
+    }
+    usleep(50 * 1000);
+    return 0;
+}